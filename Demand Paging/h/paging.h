@@ -42,6 +42,13 @@ typedef struct{
   unsigned int pd_offset : 10;		/* page directory offset	*/
 } virt_addr_t;
 
+#define BS_MAXPAGES	1024	/* largest backing store, in pages	*/
+#define BS_CHUNK	16	/* pages of store space allocated at once */
+#define BS_POOLPAGES	2048	/* pages in the backing store area	*/
+#define BS_NCHUNKS	(BS_POOLPAGES / BS_CHUNK)
+#define TLB_NBATCH	32	/* vaddrs a tlbbatch_t remembers	*/
+#define TLB_FLUSH_MAX	16	/* above this reload CR3 instead	*/
+
 typedef struct{
   int bs_status;			/* MAPPED or UNMAPPED		*/
   int bs_pid;				/* process id (or BS_XMMAP_PID for shared xmmap) */
@@ -49,16 +56,109 @@ typedef struct{
   int bs_npages;			/* number of pages in the store (for VHEAP only) */
   int bs_sem;				/* semaphore mechanism ?	*/
   int bs_type;				/* BS_TYPE_VHEAP or BS_TYPE_XMMAP */
+  int bs_xmhead;			/* first xmmap_tab entry on this store */
+  int bs_nchunks;			/* pool chunks backing the store */
+  int bs_nresv;				/* chunks set aside for it, >= bs_nchunks */
+  short bs_chunk[BS_MAXPAGES / BS_CHUNK];/* pool chunk holding each run of
+					   BS_CHUNK pages, or -1	*/
+  unsigned long bs_wmap[BS_MAXPAGES / 32];/* pages written since the store
+					   was last handed out fresh	*/
+  unsigned long bs_zmap[BS_MAXPAGES / 32];/* written pages held by the
+					   compressed tier, not the pool */
 } bs_map_t;
 
+/* A page never written reads as zeroes, so it can be zero-filled
+ * instead of copied from the store */
+#define bs_written(bs, pg)	(bsm_tab[bs].bs_wmap[(pg) >> 5] & (1UL << ((pg) & 31)))
+#define bs_mark_written(bs, pg)	(bsm_tab[bs].bs_wmap[(pg) >> 5] |= (1UL << ((pg) & 31)))
+#define bs_zipped(bs, pg)	(bsm_tab[bs].bs_zmap[(pg) >> 5] & (1UL << ((pg) & 31)))
+#define bs_mark_zipped(bs, pg)	(bsm_tab[bs].bs_zmap[(pg) >> 5] |= (1UL << ((pg) & 31)))
+
 /* Structure to track individual xmmap mappings (for shared backing stores) */
 typedef struct {
   int xm_pid;				/* process id */
   int xm_vpno;				/* starting virtual page number */
   int xm_npages;			/* number of pages */
   int xm_bs_id;				/* backing store id */
+  int xm_next;				/* next entry on the same store */
 } xmmap_entry_t;
 
+/* One page of a vectored backing store transfer */
+typedef struct {
+  int bv_page;				/* page within the backing store */
+  int bv_frm;				/* frm_tab index of the frame	*/
+} bsvec_t;
+
+/* Translations to drop at the end of a page table update */
+typedef struct {
+  int tb_n;				/* collected; may pass TLB_NBATCH */
+  unsigned long tb_vaddr[TLB_NBATCH];
+} tlbbatch_t;
+
+/* One mapped range in a process's virtual region index */
+typedef struct {
+  int vr_vpno;				/* starting virtual page number */
+  int vr_npages;			/* number of pages */
+  int vr_bs_id;				/* backing store id */
+  int vr_type;				/* BS_TYPE_VHEAP or BS_TYPE_XMMAP */
+  int vr_xm_idx;			/* xmmap_tab slot (XMMAP only) */
+  int vr_ra_next;			/* fault vpno that continues a stream */
+  int vr_ra_win;			/* current readahead window, pages */
+  int vr_advice;			/* XM_NORMAL, XM_RANDOM or XM_SEQUENTIAL */
+} vregion_t;
+
+/* Per-process index of mapped ranges, sorted by vr_vpno */
+#define NVREGIONS	16
+typedef struct {
+  int vi_count;
+  vregion_t vi_reg[NVREGIONS];
+} vindex_t;
+
+/* Virtual heap block; the links and trailing size exist only while free */
+typedef struct vhblk {
+  unsigned vb_size;			/* bytes | VB_INUSE | VB_PFREE	*/
+  unsigned vb_pad;			/* keeps payloads 8-aligned	*/
+  struct vhblk *vb_next;		/* free list of its size class	*/
+  struct vhblk *vb_prev;
+} vhblk_t;
+
+#define VB_INUSE	0x1	/* vb_size: block is allocated		*/
+#define VB_PFREE	0x2	/* vb_size: block before it is free	*/
+#define VB_HDR		8	/* header bytes before the payload	*/
+#define VB_MIN		24	/* header, links and trailing size	*/
+#define vb_len(b)	((b)->vb_size & ~07)
+#define vb_foot(b, len)	(*(unsigned *)((unsigned)(b) + (len) - sizeof(unsigned)))
+
+/* Per-process virtual heap allocator state, kept out of the heap */
+#define VH_SHIFT	4	/* class c holds blocks of 2^(c+4) bytes and up */
+#define VH_NCLASS	19	/* enough for a whole 4MB heap		*/
+typedef struct {
+  unsigned long vh_base;		/* first byte of the heap	*/
+  unsigned long vh_end;			/* first byte past the heap	*/
+  unsigned long vh_top;			/* nothing at or above this is	*/
+					/* allocated or tagged yet	*/
+  unsigned long vh_bins;		/* bit c: vh_free[c] not empty	*/
+  vhblk_t *vh_free[VH_NCLASS];
+} vheap_t;
+
+/* One paging event in the trace ring */
+typedef struct {
+  unsigned long tr_seq;			/* event number, set last	*/
+  unsigned long tr_ms;			/* ctr1000 when it happened	*/
+  short tr_type;			/* TR_FAULT ... TR_TLB		*/
+  short tr_pid;				/* process it concerns		*/
+  int tr_a, tr_b;			/* arguments, see TR_*		*/
+} trrec_t;
+
+/* A process's paging counters, as returned by pgstat() */
+typedef struct {
+  unsigned long ps_majflt;		/* faults that read a store	*/
+  unsigned long ps_minflt;		/* faults served from memory	*/
+  unsigned long ps_evict;		/* evictions it caused		*/
+  unsigned long ps_pgin;		/* bytes read from stores	*/
+  unsigned long ps_pgout;		/* bytes written to stores	*/
+} pgstat_t;
+
 typedef struct{
   int fr_status;			/* MAPPED or UNMAPPED		*/
   int fr_pid;				/* process id using this frame  */
@@ -66,8 +166,32 @@ typedef struct{
   int fr_refcnt;			/* reference count		*/
   int fr_type;				/* FR_DIR, FR_TBL, FR_PAGE	*/
   int fr_dirty;
+  int fr_bs;				/* xmmap store page cached here, */
+  int fr_bspage;			/* or fr_bs == -1		*/
+  int fr_nshare;			/* FR_TBL: directories using it	*/
+  int fr_pin;				/* locked PTEs; off the policy	*/
 }fr_map_t;
 
+/* Page replacement policy operations, selected with srpolicy() */
+typedef struct {
+  char *pp_name;
+  void (*pp_init)(void);		/* reset to an empty state	*/
+  void (*pp_insert)(int frm_idx);	/* page frame became resident	*/
+  void (*pp_touch)(int frm_idx);	/* explicit reference hint	*/
+  int  (*pp_evict)(void);		/* choose a victim or SYSERR	*/
+  void (*pp_remove)(int frm_idx);	/* page frame left memory	*/
+  void (*pp_tick)(void);		/* periodic clock hook, or NULL	*/
+} pr_policy_t;
+
+extern pr_policy_t *pr_curr;
+extern unsigned long pr_nfaults, pr_nevicts;
+extern unsigned long pr_nclass[];
+
+#define pr_insert(f)	(rss_charge(f), pr_curr->pp_insert(f))
+#define pr_touch(f)	(pr_curr->pp_touch(f))
+#define pr_evict()	(pr_curr->pp_evict())
+#define pr_remove(f)	(rss_uncharge(f), pr_curr->pp_remove(f))
+
 // the backing store mappings of the currently active process
 extern bs_map_t bsm_tab[];
 // the inverted page table used for page allocation and replacement
@@ -76,9 +200,14 @@ extern fr_map_t frm_tab[];
 #define MAX_XMMAP_ENTRIES (MAX_BS * NPROC)
 extern xmmap_entry_t xmmap_tab[];
 extern int xmmap_count;
+// per-process sorted region index used on the fault path
+extern vindex_t vr_tab[];
+// per-process virtual heap free lists
+extern vheap_t vh_tab[];
 /* Prototypes for required API calls */
 SYSCALL xmmap(int, bsd_t, int);
 SYSCALL xunmap(int);
+SYSCALL xm_release(int idx);
 
 /* Backing store management APIs */
 SYSCALL init_bsm();
@@ -88,12 +217,176 @@ SYSCALL bsm_lookup(int pid, long vaddr, int* store, int* pageth);
 SYSCALL xmmap_lookup(int pid, long vaddr, int* store, int* pageth);
 SYSCALL bsm_map(int pid, int vpno, int source, int npages);
 SYSCALL bsm_unmap(int pid, int vpno);
+SYSCALL xm_link(int idx);
+SYSCALL xm_unlink(int idx);
+
+/* Virtual region index APIs */
+SYSCALL init_vregion();
+vregion_t *vr_lookup(int pid, int vpno);
+SYSCALL vr_insert(int pid, int vpno, int npages, int bs_id, int type, int xm_idx);
+SYSCALL vr_remove(int pid, int vpno);
+
+/* Frame management APIs */
+SYSCALL init_frm();
+SYSCALL get_frm(int* avail);
+SYSCALL get_frm_vp(int* avail, int vpno);
+SYSCALL free_frm(int i);
+SYSCALL frmcolor(int on);
+SYSCALL frm_writeback(int frm_idx);
+pt_t *frm_pte(int frm_idx);
+void frm_reclaim(void);
+extern int frm_nfree, frm_reserve, frm_color;
+extern unsigned long frm_ncolored, frm_nuncolored;
+extern unsigned long frm_nreclaim, frm_nstall;
+
+/* Page table reclamation and sharing */
+void pt_unref(pd_t *pd, int pd_idx);
+pt_t *pt_reuse(int pid, pd_t *pd, int pd_idx);
+int pt_reclaim(void);
+SYSCALL pt_share(int pid, pd_t *pd, pd_t *ppd, int pd_idx);
+pt_t *pt_unshare(pd_t *pd, int pd_idx);
+void pt_drop_share(int pid, pd_t *pd, int pd_idx);
+extern unsigned long pt_nreclaim, pt_nreuse, pt_nshared;
+
+/* Virtual heap free lists */
+void vh_init(int pid, int vpno, int npages);
+int vh_class(unsigned len);
+void vh_link(vheap_t *vh, vhblk_t *b, unsigned len);
+void vh_unlink(vheap_t *vh, vhblk_t *b);
+
+/* Shared page cache for xmmap stores */
+void pc_init(void);
+int pc_lookup(int bs, int pageth);
+void pc_insert(int frm_idx, int bs, int pageth);
+void pc_remove(int frm_idx);
+SYSCALL pc_writeback(int frm_idx);
+SYSCALL pc_unmap(int frm_idx);
+SYSCALL pc_drop(int frm_idx, int pid, int dirty);
+extern unsigned long pc_nhit;
+
+/* Resident set accounting and quotas */
+SYSCALL rsslimit(int pid, int soft, int hard);
+void rss_init(void);
+void rss_charge(int frm_idx);
+void rss_uncharge(int frm_idx);
+void rss_tick(void);
+int rss_victim(int pid);
+void rss_trim(void);
+extern unsigned long frm_nlocal;
+#define rss_over(pid, q)	((q) > 0 && proctab[pid].prss >= (q))
+#define rss_full(pid)	(rss_over(pid, proctab[pid].prss_soft) || \
+			 rss_over(pid, proctab[pid].prss_hard))
+
+/* Page fault handling */
+extern unsigned long pf_nreadahead;
+pt_t *pf_table(pd_t *pd, int pd_idx);
+SYSCALL pf_prefetch(vregion_t *vr, int vpno);
+pt_t *pf_fetch(vregion_t *vr, int vpno);
+
+/* Access pattern hints */
+SYSCALL xmadvise(unsigned long vaddr, int npages, int hint);
+SYSCALL xm_discard(vregion_t *vr, int vpno, int n);
+void vh_discard(unsigned long lo, unsigned long hi);
+extern unsigned long xm_ndiscard;
+
+/* Page locking */
+SYSCALL xmlock(unsigned long vaddr, int npages);
+SYSCALL xmunlock(unsigned long vaddr, int npages);
+void xm_unlock_range(int pid, int vpno, int n);
+void xm_unlock_all(int pid);
+
+/* Paging event trace and per-process counters */
+SYSCALL trace(int mask);
+void tr_log(int type, int pid, int a, int b);
+int trace_read(unsigned long *pos, trrec_t *buf, int max);
+SYSCALL pgstat(int pid, pgstat_t *ps);
+extern int tr_mask;
+extern unsigned long tr_nlost;
+#define tr_event(t, pid, a, b)	do { if (tr_mask & (t)) tr_log((t), (pid), (a), (b)); } while (0)
+#define pg_paged_out(pid, n)	(proctab[pid].ppgout += (unsigned long)(n) * NBPG)
+
+/* Copy-on-write fork */
+SYSCALL vfork();
+SYSCALL cow_fault(pt_t *pte, int vpno);
+SYSCALL cow_writeback(int frm_idx);
+SYSCALL cow_unmap(int frm_idx);
+SYSCALL cow_drop(int frm_idx, int pid);
+pt_t *cow_pte(int pid, int vpno, int frm_idx);
+extern unsigned long pferrcode;
+
+/* Writeback daemon */
+SYSCALL init_wbd();
+void wb_kick(void);
+extern unsigned long wb_nasync, wb_nsync;
+
+/* Memory pressure notification */
+SYSCALL pgnotify(int level);
+SYSCALL pgpressure(void);
+int frm_pressure(void);
+void pp_update(void);
+extern unsigned long pp_nsent;
+
+/* Page replacement policy APIs */
+SYSCALL srpolicy(int policy);
+SYSCALL grpolicy();
+void pr_clock(void);
+
+/* CPU control */
+unsigned long read_cr0(void);
+unsigned long read_cr4(void);
+void write_cr4(unsigned long);
+unsigned long cpu_features(void);
+void init_global_pde(pd_t *pd);
+extern int pg_pse;
 
 /* given calls for dealing with backing store */
 
 SYSCALL read_bs(char *, bsd_t, int);
 SYSCALL write_bs(char *, bsd_t, int);
+SYSCALL read_bs_v(bsd_t, bsvec_t *, int);
+SYSCALL write_bs_v(bsd_t, bsvec_t *, int);
+SYSCALL copy_bs(bsd_t, bsd_t, int);
+void bs_clear(int bs_id);
+char *bs_addr(int bs_id, int page);
+char *bs_alloc(int bs_id, int page);
+SYSCALL bs_reserve(int bs_id, int npages);
+void bs_unreserve(int bs_id);
+extern unsigned long bs_nzfill;
+extern int bs_nfree;
+
+/* Compressed in-memory tier in front of the store pool */
+SYSCALL zswap(int on);
+void zs_init(void);
+SYSCALL zs_store(char *src, int bs, int pageth);
+SYSCALL zs_load(char *dst, int bs, int pageth);
+SYSCALL zs_copy(int dst, int src, int pageth);
+void zs_forget(int bs, int pageth);
+extern int zs_on, zs_nunits;
+extern unsigned long zs_nzero, zs_nsame, zs_ncomp, zs_nreject;
+
+/* Page-sized memory kernels */
+void pg_init(void);
+void pg_zero(void *dst);
+void pg_fill(void *dst, unsigned long val);
+void pg_copy(void *dst, void *src, int n);
+extern int pg_mmx;
+
+/* Demand-paged process stacks */
+void stk_init(void);
+void stk_map(pd_t *pd);
+void stk_refill(void);
+unsigned long *stk_alloc(int pid);
+SYSCALL stk_grow(int pid, int vpno, int pool_only);
+void stk_free(int pid);
+extern int stk_paged;
+extern unsigned long stk_ngrow, stk_ndouble, stk_noverflow;
+SYSCALL bsv_check(bsvec_t *, int);
+int bsv_run(bsd_t, bsvec_t *, int);
 SYSCALL invltlb(unsigned long);
+#define tlb_begin(tb)	((tb)->tb_n = 0)
+void tlb_add(tlbbatch_t *tb, int pid, unsigned long vaddr);
+void tlb_flush(tlbbatch_t *tb);
+extern unsigned long tlb_npage, tlb_nfull, tlb_nswitch;
 
 #define NBPG		4096	/* number of bytes per page	*/
 #define FRAME0		1024	/* zero-th frame		*/
@@ -115,12 +408,85 @@ SYSCALL invltlb(unsigned long);
 #define FR_PAGE		0
 #define FR_TBL		1
 #define FR_DIR		2
+#define FR_STK		3	/* paged stack page or its table	*/
+
+#define PT_COW		0x1	/* pt_avail: write-protected for COW	*/
+#define PT_LOCK		0x2	/* pt_avail: xmlock()ed by this process	*/
+#define PT_EMPTY	0x2	/* a PTE not present but writable	*/
+
+#define PF_PROT		0x1	/* pferrcode: protection violation	*/
+#define PF_WRITE	0x2	/* pferrcode: fault was a write		*/
+
+#define CPUID_PSE	(1 << 3)	/* cpu_features: 4MB pages	*/
+#define CR4_PSE		(1 << 4)	/* CR4: enable 4MB pages	*/
+#define CPUID_PGE	(1 << 13)	/* cpu_features: global pages	*/
+#define CR4_PGE		(1 << 7)	/* CR4: enable global pages	*/
+#define CPUID_MMX	(1 << 23)	/* cpu_features: MMX		*/
+#define CR0_EM		(1 << 2)	/* CR0: no FPU, trap its opcodes	*/
+#define CR0_TS		(1 << 3)	/* CR0: trap FPU use after a switch */
+#define EFLAGS_IF	(1 << 9)	/* EFLAGS: interrupts enabled	*/
 
 #define SC 3
 #define AGING 4
+#define CAR 5
+#define WSCLOCK 6
+
+#define PR_NCLASS	4	/* victim classes: 2 * referenced + dirty */
+#define PR_TICK_MS	10	/* clock ticks between pr_clock() calls	*/
+
+#define TR_NREC		1024	/* trace ring size, a power of two	*/
+#define TR_FAULT	0x01	/* a = vpno, b = 1 if major		*/
+#define TR_EVICT	0x02	/* a = vpno, b = frame			*/
+#define TR_WB		0x04	/* a = vpno, b = pages written		*/
+#define TR_READ		0x08	/* a = store, b = page			*/
+#define TR_TLB		0x10	/* a = pages, b = 1 if whole TLB	*/
+#define TR_ALL		0x1F
+
+#define WS_SCAN		10	/* pr_clock() calls per working set scan */
+#define WS_TAU_MS	1000	/* working set window			*/
+
+#define RA_MIN		4	/* first window of a sequential stream	*/
+#define RA_MAX		32	/* largest readahead window		*/
+
+#define XM_NORMAL	0	/* xmadvise: readahead on detected streams */
+#define XM_RANDOM	1	/* xmadvise: never read ahead		*/
+#define XM_SEQUENTIAL	2	/* xmadvise: full window, drop behind	*/
+#define XM_WILLNEED	3	/* xmadvise: map the pages now		*/
+#define XM_DONTNEED	4	/* xmadvise: drop them, zero on next use */
+#define XM_LOCKLIM	64	/* pages one process may xmlock()	*/
+
+#define BS_NVEC		32	/* pages batched per vectored transfer	*/
+
+#define WB_CLUSTER	8	/* dirty neighbours written with a victim */
+
+#define FRM_RESERVE	16	/* free frames kept for page faults	*/
+#define FRM_NCOLOR	16	/* L2 size / (ways * NBPG); divides 32	*/
+#define WB_LOWAT	32	/* wake the writeback daemon below this	*/
+#define WB_HIWAT	96	/* free + clean cold frames it aims for	*/
+#define WB_PRIO		100	/* writeback daemon priority		*/
+#define WB_STK		2048	/* writeback daemon stack size		*/
+
+#define PP_NONE		0	/* pressure: free pool above WB_HIWAT	*/
+#define PP_LOW		1	/* the daemon is refilling the pool	*/
+#define PP_MEDIUM	2	/* free pool below WB_LOWAT		*/
+#define PP_CRITICAL	3	/* down to the reserve, faults evict	*/
+#define PP_WINDOW	100	/* ms over which evictions are counted	*/
+#define PP_EVRATE	32	/* evictions per window that add a level */
+#define PP_MSGBASE	0x50500000	/* pgnotify messages are this | level */
+#define pp_ismsg(m)	(((m) & ~0xF) == PP_MSGBASE)
+#define pp_msglevel(m)	((m) & 0xF)
+
+#define STK_VPNO	0xF0000	/* paged stacks, one slot per process	*/
+#define STK_SLOT	32	/* pages per slot; the lowest is the guard */
+#define STK_MAX		((STK_SLOT - 1) * NBPG)	/* largest paged stack	*/
+#define STK_NPT		((NPROC * STK_SLOT + 1023) / 1024)
+#define STK_PDE		(STK_VPNO >> 10)
+#define STK_NPOOL	8	/* frames kept for growth on a double fault */
+#define DF_STKWORDS	2048	/* double fault task stack		*/
+#define stk_slot(pid)	(STK_VPNO + (pid) * STK_SLOT)
+#define stk_area(vpno)	((vpno) >= STK_VPNO && (vpno) < stk_slot(NPROC))
 
 #define BACKING_STORE_BASE	0x00800000
-#define BACKING_STORE_UNIT_SIZE 0x00100000
 
-/* Number of backing stores */
-#define MAX_BS 8
+/* Number of backing stores; their space comes from one shared pool */
+#define MAX_BS 32
@@ -77,6 +77,19 @@ struct	pentry	{
         int     vhpno;                  /* starting pageno for vheap    */
         int     vhpnpages;              /* vheap size                   */
         struct mblock *vmemlist;        /* vheap list              	*/
+        int     prss;                   /* resident pages charged to us */
+        int     prss_soft;              /* soft frame quota, 0 if none  */
+        int     prss_hard;              /* hard frame quota, 0 if none  */
+        int     pwss;                   /* working set size estimate    */
+        int     prss_hand;              /* local replacement clock hand */
+        unsigned long pmajflt;          /* faults that read a store     */
+        unsigned long pminflt;          /* faults served from memory    */
+        unsigned long pnevict;          /* evictions we caused          */
+        unsigned long ppgin;            /* bytes paged in               */
+        unsigned long ppgout;           /* bytes paged out              */
+        int     ppwant;                 /* pressure level to report at  */
+        int     pptold;                 /* pressure level last reported */
+        int     plocked;                /* pages we hold xmlock()ed     */
 };
 
 
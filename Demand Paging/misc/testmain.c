@@ -11,6 +11,58 @@
 #define PROC2_VPNO      0x80000
 #define TEST1_BS	1
 
+#define BENCH_BS	2
+#define BENCH_VPNO	0x50000
+#define BENCH_PAGES	64
+#define FILLER_BS	3
+#define FILLER_VPNO	0x60000
+#define NFILLERS	16
+#define FILLER_MAPS	14
+#define POLICY_VPNO	0x70000
+#define POLICY_HOT	64
+#define POLICY_COLD	1200
+#define STREAM_PAGES	192
+#define FORK_PAGES	64
+#define NWORKERS	4
+#define HOG_PAGES	240
+#define HOG_QUOTA	32
+#define HOT_PAGES	48
+#define SHARE_BS	4
+#define SHARE_PAGES	64
+#define SHARE_VPNO	0x90000
+#define BIG_PAGES	1024
+#define BIG_STRIDE	64
+#define ZS_PAGES	96
+#define ZS_QUOTA	16
+#define TR_PAGES	64
+#define TR_QUOTA	16
+#define TR_BATCH	64
+#define PG_REPS		256
+#define CACHE_CHUNK	32
+#define CACHE_NCHUNK	30
+#define ADV_PAGES	64
+#define LOCK_PAGES	32
+#define LOCK_HOG	900
+#define STK_FRAME	1024
+#define STK_DEPTH	24
+#define STK_BIG		(16 * NBPG)
+#define STK_SMALL	(2 * NBPG)
+#define EXIT_PAGES	128
+#define EXIT_NPROC	4
+#define COLOR_PAGES	512
+#define COLOR_PASSES	16
+
+char *fork_heap;			/* heap block the workers inherit	*/
+
+extern unsigned long ctr1000;
+
+/* rdtsc - read the CPU time-stamp counter */
+static unsigned long long rdtsc(void) {
+	unsigned long long t;
+	asm volatile("rdtsc" : "=A"(t));
+	return t;
+}
+
 void proc1_test1(char *msg, int lck) {
 	char *addr;
 	int i;
@@ -69,9 +121,664 @@ void proc1_test3(char *msg, int lck) {
 	return;
 }
 
+/* Holds FILLER_MAPS one-page xmmaps so the mapping tables fill up */
+void filler(char *msg, int lck) {
+	int i;
+
+	for (i = 0; i < FILLER_MAPS; i++) {
+		xmmap(FILLER_VPNO + i * 16, FILLER_BS, 1);
+	}
+	sleep(10);
+	for (i = 0; i < FILLER_MAPS; i++) {
+		xmunmap(FILLER_VPNO + i * 16);
+	}
+}
+
+/* Average cycles to resolve BENCH_PAGES first-touch faults */
+void proc1_test4(char *msg, int lck) {
+	char *addr;
+	int i;
+	unsigned long long t0, total;
+
+	if (xmmap(BENCH_VPNO, BENCH_BS, BENCH_PAGES) == SYSERR) {
+		kprintf("xmmap call failed\n");
+		return;
+	}
+
+	addr = (char *)(BENCH_VPNO << 12);
+	total = 0;
+	for (i = 0; i < BENCH_PAGES; i++) {
+		t0 = rdtsc();
+		*(addr + i * NBPG) = 'a';
+		total += rdtsc() - t0;
+	}
+	kprintf("%s: %d xmmap slots, %u cycles/fault\n", msg, xmmap_count,
+		(unsigned)(total / BENCH_PAGES));
+
+	xmunmap(BENCH_VPNO);
+}
+
+/* Hot set revisited between long cold sweeps; reports faults per policy */
+void proc1_test5(char *msg, int lck) {
+	char *addr;
+	int i, round;
+
+	for (i = 0; i < 8; i++) {
+		if (xmmap(POLICY_VPNO + i * 256, i, 256) == SYSERR) {
+			kprintf("xmmap call failed\n");
+			return;
+		}
+	}
+
+	addr = (char *)(POLICY_VPNO << 12);
+	for (round = 0; round < 4; round++) {
+		for (i = 0; i < POLICY_COLD; i++) {
+			*(addr + (POLICY_HOT + i) * NBPG) = 'c';
+			*(addr + (i % POLICY_HOT) * NBPG) = 'h';
+		}
+	}
+	kprintf("%s: %u faults, %u evictions\n", msg, pr_nfaults, pr_nevicts);
+	kprintf("%s: victims clean %u, dirty %u, referenced %u, both %u\n",
+		msg, pr_nclass[0], pr_nclass[1], pr_nclass[2], pr_nclass[3]);
+	kprintf("%s: %u pages cleaned ahead, %u cleaned on eviction\n", msg,
+		wb_nasync, wb_nsync);
+	kprintf("%s: %u pages reclaimed ahead, %u evicted on the fault path\n",
+		msg, frm_nreclaim, frm_nstall);
+
+	for (i = 0; i < 8; i++) {
+		xmunmap(POLICY_VPNO + i * 256);
+	}
+}
+
+/* Sequential pass over a private heap; reports traps taken per page */
+void proc1_test6(char *msg, int lck) {
+	char *addr;
+	int i;
+	unsigned long faults, ra, zf;
+	unsigned long long t0;
+
+	if ((addr = vgetmem(STREAM_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	faults = pr_nfaults;
+	ra = pf_nreadahead;
+	zf = bs_nzfill;
+	t0 = rdtsc();
+	for (i = 0; i < STREAM_PAGES; i++) {
+		*(addr + i * NBPG) = 's';
+	}
+	kprintf("%s: %d pages, %u faults, %u read ahead, %u cycles/page\n", msg,
+		STREAM_PAGES, pr_nfaults - faults, pf_nreadahead - ra,
+		(unsigned)((rdtsc() - t0) / STREAM_PAGES));
+	kprintf("%s: %u pages zero-filled\n", msg, bs_nzfill - zf);
+	vfreemem(addr, STREAM_PAGES * NBPG);
+}
+
+/* Inherited heap: reads must not fault, a write copies only its page */
+void fork_worker(char *msg, int lck) {
+	int i, sum;
+	unsigned long faults;
+
+	faults = pr_nfaults;
+	sum = 0;
+	for (i = 0; i < FORK_PAGES; i++) {
+		sum += *(fork_heap + i * NBPG);
+	}
+	*fork_heap = 'w';
+	kprintf("%s: sum %d, %u page-ins, parent data %s\n", msg, sum,
+		pr_nfaults - faults, *(fork_heap + NBPG) == 'p' ? "ok" : "LOST");
+}
+
+void proc1_test7(char *msg, int lck) {
+	int i;
+
+	if ((fork_heap = vgetmem(FORK_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (i = 0; i < FORK_PAGES; i++) {
+		*(fork_heap + i * NBPG) = 'p';
+	}
+	for (i = 0; i < NWORKERS; i++) {
+		resume(vfork(fork_worker, 2000, 20, "worker", 2, msg, 0));
+	}
+	sleep(1);
+	kprintf("%s: parent still sees %c\n", msg, *fork_heap);
+}
+
+/* pt_frames - frames currently holding page tables */
+int pt_frames(void) {
+	int i, n = 0;
+
+	for (i = 0; i < NFRAMES; i++) {
+		if (frm_tab[i].fr_status == FRM_MAPPED &&
+		    frm_tab[i].fr_type == FR_TBL) {
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Only reads its inherited heap, so it never needs a page table of its
+ * own */
+void pt_reader(char *msg, int lck) {
+	int i, sum = 0;
+
+	for (i = 0; i < FORK_PAGES; i++) {
+		sum += *(fork_heap + i * NBPG);
+	}
+	sleep(1);
+}
+
+void test13_ptshare(char *msg, int lck) {
+	int i, before;
+	unsigned long shared = pt_nshared;
+
+	if ((fork_heap = vgetmem(FORK_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (i = 0; i < FORK_PAGES; i++) {
+		*(fork_heap + i * NBPG) = 'p';
+	}
+	before = pt_frames();
+	for (i = 0; i < NWORKERS; i++) {
+		resume(vfork(pt_reader, 2000, 20, "reader", 2, msg, 0));
+	}
+	sleep10(5);
+	kprintf("%s: %d page table frames before %d vforks, %d after, "
+		"%u tables shared\n", msg, before, NWORKERS, pt_frames(),
+		pt_nshared - shared);
+	*fork_heap = 'w';
+	kprintf("%s: parent write unshared its table, %d page table frames\n",
+		msg, pt_frames());
+	sleep(1);
+	kprintf("%s: %u idle tables reused, %u reclaimed so far\n", msg,
+		pt_nreuse, pt_nreclaim);
+}
+
+/* Streams through its whole heap; with a hard quota it recycles its own
+ * frames instead of pushing the hot set of test8_hot out */
+void test8_hog(char *msg, int lck) {
+	char *addr;
+	int i, pass;
+
+	if ((addr = vgetmem(HOG_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (pass = 0; pass < 4; pass++) {
+		for (i = 0; i < HOG_PAGES; i++) {
+			*(addr + i * NBPG) = 'g';
+		}
+	}
+	kprintf("%s: rss %d (hard quota %d), working set %d, %u local victims\n",
+		msg, proctab[currpid].prss, proctab[currpid].prss_hard,
+		proctab[currpid].pwss, frm_nlocal);
+	vfreemem(addr, HOG_PAGES * NBPG);
+}
+
+void test8_hot(char *msg, int lck) {
+	char *addr;
+	int i, round;
+
+	if ((addr = vgetmem(HOT_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (round = 0; round < 200; round++) {
+		for (i = 0; i < HOT_PAGES; i++) {
+			*(addr + i * NBPG) = 'h';
+		}
+		sleep10(1);
+	}
+	kprintf("%s: rss %d, working set %d\n", msg, proctab[currpid].prss,
+		proctab[currpid].pwss);
+}
+
+/* Producer and consumer map the same store at different addresses and
+ * see each other's writes through the same frames */
+void test9_share(char *msg, int lck) {
+	char *addr;
+	int i, bad;
+	unsigned long faults, hits;
+
+	if (xmmap(SHARE_VPNO + lck * SHARE_PAGES, SHARE_BS, SHARE_PAGES) == SYSERR) {
+		kprintf("xmmap call failed\n");
+		return;
+	}
+	addr = (char *)((SHARE_VPNO + lck * SHARE_PAGES) << 12);
+	faults = pr_nfaults;
+	hits = pc_nhit;
+	bad = 0;
+	for (i = 0; i < SHARE_PAGES; i++) {
+		if (lck == 0) {
+			*(addr + i * NBPG) = 'a' + i % 26;
+		} else if (*(addr + i * NBPG) != 'a' + i % 26) {
+			bad++;
+		}
+	}
+	kprintf("%s: %u faults, %u from the page cache, %d stale pages\n", msg,
+		pr_nfaults - faults, pc_nhit - hits, bad);
+	sleep(1);
+	xmunmap(SHARE_VPNO + lck * SHARE_PAGES);
+}
+
+/* A heap four old stores big; writing a few scattered pages only takes
+ * pool space for the chunks they fall in */
+void test10_big(char *msg, int lck) {
+	char *addr;
+	int i;
+
+	if ((addr = vgetmem((BIG_PAGES - 1) * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (i = 0; i < BIG_PAGES - 1; i += BIG_STRIDE) {
+		*(addr + i * NBPG) = 'b';
+	}
+	kprintf("%s: %d-page heap, %d resident, %d of %d pool chunks in use\n",
+		msg, BIG_PAGES, proctab[currpid].prss, BS_NCHUNKS - bs_nfree,
+		BS_NCHUNKS);
+	vfreemem(addr, (BIG_PAGES - 1) * NBPG);
+}
+
+/* Writes zeroed, same-filled and text pages through a small quota, so
+ * all of them are evicted, then checks them and counts the pool chunks
+ * it took */
+void test11_zswap(char *msg, int lck) {
+	char *addr;
+	unsigned long zero, same, comp;
+	int i, j, chunks, bad = 0;
+
+	zero = zs_nzero;
+	same = zs_nsame;
+	comp = zs_ncomp;
+	chunks = bs_nfree;
+	if ((addr = vgetmem(ZS_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (i = 0; i < ZS_PAGES; i++) {
+		for (j = 0; j < NBPG; j += 4) {
+			switch (i % 3) {
+			case 0:	*(unsigned long *)(addr + i * NBPG + j) = 0;
+				break;
+			case 1:	*(unsigned long *)(addr + i * NBPG + j) = 0x5a5a5a5a;
+				break;
+			default: addr[i * NBPG + j] = 'a' + (j / 4) % 26;
+			}
+		}
+	}
+	for (i = 0; i < ZS_PAGES; i++) {
+		j = 4 * (i % 26);
+		if ((i % 3 == 0 && addr[i * NBPG + j] != 0) ||
+		    (i % 3 == 1 && addr[i * NBPG + j] != 0x5a) ||
+		    (i % 3 == 2 && addr[i * NBPG + j] != 'a' + (j / 4) % 26)) {
+			bad++;
+		}
+	}
+	kprintf("%s: %u zero, %u same-filled, %u compressed, %d pool chunks, "
+		"%d units in the tier, %d bad pages\n", msg, zs_nzero - zero,
+		zs_nsame - same, zs_ncomp - comp, chunks - bs_nfree, zs_nunits, bad);
+	vfreemem(addr, ZS_PAGES * NBPG);
+}
+
+/* Pages through a heap under a small quota while the tracer records */
+void test12_traced(char *msg, int lck) {
+	char *addr;
+	int i, pass;
+
+	if ((addr = vgetmem(TR_PAGES * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < TR_PAGES; i++) {
+			*(addr + i * NBPG) = 't';
+		}
+	}
+	sleep(4);		/* stay around for the reader's pgstat() */
+}
+
+/* Drains the trace while test12_traced runs and tallies it by type,
+ * then reads the traced process's counters */
+void test12_reader(char *msg, int pid) {
+	static trrec_t buf[TR_BATCH];
+	static char *names[] = { "fault", "evict", "writeback", "read", "tlb" };
+	unsigned long pos = 0, count[5], first = 0, last = 0;
+	pgstat_t ps;
+	int i, n, t, round;
+
+	for (t = 0; t < 5; t++) {
+		count[t] = 0;
+	}
+	for (round = 0; round < 20; round++) {
+		while ((n = trace_read(&pos, buf, TR_BATCH)) > 0) {
+			for (i = 0; i < n; i++) {
+				for (t = 0; (1 << t) != buf[i].tr_type; t++)
+					;
+				count[t]++;
+				if (first == 0) {
+					first = buf[i].tr_ms;
+				}
+				last = buf[i].tr_ms;
+			}
+		}
+		sleep10(1);
+	}
+	for (t = 0; t < 5; t++) {
+		kprintf("%s: %u %s events\n", msg, count[t], names[t]);
+	}
+	kprintf("%s: %u lost, %u ms traced\n", msg, tr_nlost, last - first);
+	if (pgstat(pid, &ps) == OK) {
+		kprintf("%s: pid %d %u major, %u minor faults, %u evictions, "
+			"%u bytes in, %u bytes out\n", msg, pid, ps.ps_majflt,
+			ps.ps_minflt, ps.ps_evict, ps.ps_pgin, ps.ps_pgout);
+	}
+}
+
+/* pt_init_fields - clear a page table one bitfield at a time */
+static void pt_init_fields(pt_t *pt) {
+	int i;
+
+	for (i = 0; i < 1024; i++) {
+		pt[i].pt_pres = 0;
+		pt[i].pt_write = 1;
+		pt[i].pt_user = 0;
+		pt[i].pt_pwt = 0;
+		pt[i].pt_pcd = 0;
+		pt[i].pt_acc = 0;
+		pt[i].pt_dirty = 0;
+		pt[i].pt_mbz = 0;
+		pt[i].pt_global = 0;
+		pt[i].pt_avail = 0;
+		pt[i].pt_base = 0;
+	}
+}
+
+/* Cycles per page for table init, zeroing and copying, by kernel */
+void test14_kernels(char *msg, int lck) {
+	char *buf, *a, *b;
+	int i, mmx, saved;
+	unsigned long long t0, tf, tz, tc;
+
+	if ((buf = (char *)getmem(3 * NBPG)) == (char *)SYSERR) {
+		kprintf("getmem call failed\n");
+		return;
+	}
+	a = (char *)(((unsigned long)buf + NBPG - 1) & ~(NBPG - 1));
+	b = a + NBPG;
+
+	t0 = rdtsc();
+	for (i = 0; i < PG_REPS; i++) {
+		pt_init_fields((pt_t *)a);
+	}
+	tf = rdtsc() - t0;
+	t0 = rdtsc();
+	for (i = 0; i < PG_REPS; i++) {
+		bcopy(a, b, NBPG);
+	}
+	tc = rdtsc() - t0;
+	kprintf("%s: bitfields: pt init %u, bcopy %u cycles/page\n", msg,
+		(unsigned)(tf / PG_REPS), (unsigned)(tc / PG_REPS));
+
+	saved = pg_mmx;
+	for (mmx = 0; mmx <= saved; mmx++) {
+		pg_mmx = mmx;
+		t0 = rdtsc();
+		for (i = 0; i < PG_REPS; i++) {
+			pg_fill(a, PT_EMPTY);
+		}
+		tf = rdtsc() - t0;
+		t0 = rdtsc();
+		for (i = 0; i < PG_REPS; i++) {
+			pg_zero(a);
+		}
+		tz = rdtsc() - t0;
+		t0 = rdtsc();
+		for (i = 0; i < PG_REPS; i++) {
+			pg_copy(b, a, 1);
+		}
+		tc = rdtsc() - t0;
+		kprintf("%s: %s: pt init %u, zero %u, copy %u cycles/page\n", msg,
+			mmx ? "mmx" : "rep", (unsigned)(tf / PG_REPS),
+			(unsigned)(tz / PG_REPS), (unsigned)(tc / PG_REPS));
+	}
+	pg_mmx = saved;
+	if (!saved) {
+		kprintf("%s: no MMX on this CPU\n", msg);
+	}
+	freemem((struct mblock *)buf, 3 * NBPG);
+}
+
+/* A cache that grows until the kernel reports pressure, then halves */
+void test15_cache(char *msg, int lck) {
+	char *chunk[CACHE_NCHUNK];
+	int n, i, k;
+	WORD m;
+
+	pgnotify(PP_MEDIUM);
+	recvclr();
+	for (n = 0; n < CACHE_NCHUNK; n++) {
+		if ((chunk[n] = vgetmem(CACHE_CHUNK * NBPG)) == (char *)SYSERR) {
+			break;
+		}
+		for (i = 0; i < CACHE_CHUNK; i++) {
+			*(chunk[n] + i * NBPG) = 'c';
+		}
+		if (pp_ismsg(m = recvclr())) {
+			kprintf("%s: pressure %d at %d pages, %d frames free\n",
+				msg, pp_msglevel(m), (n + 1) * CACHE_CHUNK, frm_nfree);
+			n++;
+			break;
+		}
+	}
+	for (k = n / 2; k < n; k++) {
+		vfreemem(chunk[k], CACHE_CHUNK * NBPG);
+	}
+	kprintf("%s: kept %d of %d pages, %u messages sent, level now %d\n",
+		msg, n / 2 * CACHE_CHUNK, n * CACHE_CHUNK, pp_nsent,
+		pgpressure());
+	pgnotify(PP_NONE);
+}
+
+/* Faults taken by currpid while touching n pages from addr */
+static unsigned long touch_faults(char *addr, int n, char c) {
+	unsigned long f;
+	int i;
+
+	f = proctab[currpid].pmajflt + proctab[currpid].pminflt;
+	for (i = 0; i < n; i++) {
+		*(addr + i * NBPG) = c;
+	}
+	return proctab[currpid].pmajflt + proctab[currpid].pminflt - f;
+}
+
+/* Each hint on its own range of a private heap */
+void test16_advise(char *msg, int lck) {
+	char *buf, *a;
+	int rss;
+	unsigned long d;
+
+	if ((buf = vgetmem((3 * ADV_PAGES + 1) * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	a = (char *)(((unsigned long)buf + NBPG - 1) & ~(NBPG - 1));
+
+	xmadvise((unsigned long)a, ADV_PAGES, XM_WILLNEED);
+	kprintf("%s: WILLNEED: %u faults over %d pages\n", msg,
+		touch_faults(a, ADV_PAGES, 'w'), ADV_PAGES);
+
+	rss = proctab[currpid].prss;
+	d = xm_ndiscard;
+	xmadvise((unsigned long)a, ADV_PAGES, XM_DONTNEED);
+	kprintf("%s: DONTNEED: %u frames dropped, rss %d -> %d, reads back %d\n",
+		msg, xm_ndiscard - d, rss, proctab[currpid].prss, *a);
+
+	xmadvise((unsigned long)a, 3 * ADV_PAGES, XM_RANDOM);
+	kprintf("%s: RANDOM: %u faults over %d pages\n", msg,
+		touch_faults(a + ADV_PAGES * NBPG, ADV_PAGES, 'r'), ADV_PAGES);
+	xmadvise((unsigned long)a, 3 * ADV_PAGES, XM_SEQUENTIAL);
+	kprintf("%s: SEQUENTIAL: %u faults over %d pages\n", msg,
+		touch_faults(a + 2 * ADV_PAGES * NBPG, ADV_PAGES, 's'), ADV_PAGES);
+	xmadvise((unsigned long)a, 3 * ADV_PAGES, XM_NORMAL);
+	vfreemem(buf, (3 * ADV_PAGES + 1) * NBPG);
+}
+
+/* A locked buffer keeps its frames while a big sweep evicts the rest */
+void test17_lock(char *msg, int lck) {
+	char *buf, *a, *hog;
+	unsigned long long t0;
+	unsigned long f;
+
+	if ((buf = vgetmem((2 * LOCK_PAGES + 1) * NBPG)) == (char *)SYSERR ||
+	    (hog = vgetmem(LOCK_HOG * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	a = (char *)(((unsigned long)buf + NBPG - 1) & ~(NBPG - 1));
+	if (xmlock((unsigned long)a, LOCK_PAGES) == SYSERR) {
+		kprintf("xmlock call failed\n");
+		return;
+	}
+	kprintf("%s: %d pages locked, locking %d more %s\n", msg,
+		proctab[currpid].plocked, XM_LOCKLIM,
+		xmlock((unsigned long)(a + LOCK_PAGES * NBPG), XM_LOCKLIM) == SYSERR ?
+		"refused" : "allowed");
+	touch_faults(a + LOCK_PAGES * NBPG, LOCK_PAGES, 'u');
+	touch_faults(hog, LOCK_HOG, 'h');
+
+	t0 = rdtsc();
+	f = touch_faults(a, LOCK_PAGES, 'l');
+	kprintf("%s: locked: %u faults, %u cycles/page\n", msg, f,
+		(unsigned)((rdtsc() - t0) / LOCK_PAGES));
+	t0 = rdtsc();
+	f = touch_faults(a + LOCK_PAGES * NBPG, LOCK_PAGES, 'u');
+	kprintf("%s: unlocked: %u faults, %u cycles/page\n", msg, f,
+		(unsigned)((rdtsc() - t0) / LOCK_PAGES));
+
+	xmunlock((unsigned long)a, LOCK_PAGES);
+	kprintf("%s: %d pages locked after xmunlock\n", msg,
+		proctab[currpid].plocked);
+	vfreemem(hog, LOCK_HOG * NBPG);
+	vfreemem(buf, (2 * LOCK_PAGES + 1) * NBPG);
+}
+
+/* About a page of stack every four calls, all of it touched */
+static int stk_recurse(int depth) {
+	char pad[STK_FRAME];
+	int i;
+
+	for (i = 0; i < STK_FRAME; i += 64) {
+		pad[i] = (char)depth;
+	}
+	if (depth == 0) {
+		return pad[0];
+	}
+	return pad[STK_FRAME - 64] + stk_recurse(depth - 1);
+}
+
+/* A paged stack grows as the recursion deepens */
+void test18_stack(char *msg, int depth) {
+	unsigned long g = stk_ngrow, d = stk_ndouble;
+
+	stk_recurse(depth);
+	kprintf("%s: depth %d: %u stack pages added, %u on a double fault\n",
+		msg, depth, stk_ngrow - g, stk_ndouble - d);
+}
+
+/* Dirties its heap and waits to be killed */
+void test19_worker(char *msg, int n) {
+	char *buf;
+
+	if ((buf = vgetmem(n * NBPG)) == (char *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	touch_faults(buf, n, 'x');
+	suspend(getpid());
+}
+
+/* What it costs to kill a process with a dirty heap */
+void test19_exit(char *msg, int lck) {
+	unsigned long long t0, t = 0;
+	int pid, i;
+
+	for (i = 0; i < EXIT_NPROC; i++) {
+		// Runs at once and stops after dirtying its pages
+		pid = vcreate(test19_worker, 2000, EXIT_PAGES + 1, 30, "worker", 2,
+			"worker", EXIT_PAGES);
+		resume(pid);
+		t0 = rdtsc();
+		kill(pid);
+		t += rdtsc() - t0;
+	}
+	kprintf("%s: %u cycles per kill with %d dirty heap pages, %d frames free\n",
+		msg, (unsigned)(t / EXIT_NPROC), EXIT_PAGES, frm_nfree);
+}
+
+/* Stream over a heap array whose frames were picked with coloring on or
+ * off, as frmcolor() last set it */
+void test20_color(char *msg, int lck) {
+	unsigned long *buf;
+	unsigned long long t0, t;
+	unsigned long sum = 0, c, u, ms;
+	int i, k, n = COLOR_PAGES * NBPG / sizeof(long);
+
+	c = frm_ncolored;
+	u = frm_nuncolored;
+	if ((buf = (unsigned long *)vgetmem(COLOR_PAGES * NBPG)) ==
+	    (unsigned long *)SYSERR) {
+		kprintf("vgetmem call failed\n");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		buf[i] = i;
+	}
+	c = frm_ncolored - c;
+	u = frm_nuncolored - u;
+
+	ms = ctr1000;
+	t0 = rdtsc();
+	for (k = 0; k < COLOR_PASSES; k++) {
+		for (i = 0; i < n; i++) {
+			sum += buf[i];
+		}
+	}
+	t = rdtsc() - t0;
+	if ((ms = ctr1000 - ms) == 0) {
+		ms = 1;
+	}
+	kprintf("%s: %u of %u frames colored, %u cycles/page, %u KB/s (sum %u)\n",
+		msg, c, c + u, (unsigned)(t / (COLOR_PAGES * COLOR_PASSES)),
+		COLOR_PAGES * (NBPG / 1024) * COLOR_PASSES * 1000 / ms, sum);
+	vfreemem((char *)buf, COLOR_PAGES * NBPG);
+}
+
+/* tlb_report - TLB invalidations per second since the last report */
+void tlb_report(char *msg) {
+	static unsigned long ms, npage, nfull, nswitch;
+	unsigned long dt;
+
+	if ((dt = ctr1000 - ms) == 0) {
+		dt = 1;
+	}
+	kprintf("%s: %u invlpg/s, %u full flushes/s, %u CR3 switches/s\n", msg,
+		(tlb_npage - npage) * 1000 / dt, (tlb_nfull - nfull) * 1000 / dt,
+		(tlb_nswitch - nswitch) * 1000 / dt);
+	ms = ctr1000;
+	npage = tlb_npage;
+	nfull = tlb_nfull;
+	nswitch = tlb_nswitch;
+}
+
 int main() {
 	int pid1;
 	int pid2;
+	unsigned long nover;
 
 	kprintf("\n1: shared memory\n");
 	pid1 = create(proc1_test1, 2000, 20, "proc1_test1", 0, NULL);
@@ -88,4 +795,130 @@ int main() {
 	pid1 = create(proc1_test3, 2000, 20, "proc1_test3", 0, NULL);
 	resume(pid1);
 	sleep(3);
+
+	kprintf("\n4: fault latency vs. number of mappings\n");
+	pid1 = create(proc1_test4, 2000, 20, "proc1_test4", 2, "few", 0);
+	resume(pid1);
+	sleep(1);
+	for (pid2 = 0; pid2 < NFILLERS; pid2++) {
+		resume(create(filler, 2000, 20, "filler", 0, NULL));
+	}
+	sleep(1);
+	pid1 = create(proc1_test4, 2000, 20, "proc1_test4", 2, "many", 0);
+	resume(pid1);
+	sleep(3);
+
+	kprintf("\n5: replacement policies\n");
+	srpolicy(SC);
+	resume(create(proc1_test5, 2000, 20, "proc1_test5", 2, "SC", 0));
+	sleep(5);
+	srpolicy(AGING);
+	resume(create(proc1_test5, 2000, 20, "proc1_test5", 2, "AGING", 0));
+	sleep(5);
+	srpolicy(CAR);
+	resume(create(proc1_test5, 2000, 20, "proc1_test5", 2, "CAR", 0));
+	sleep(5);
+	srpolicy(WSCLOCK);
+	resume(create(proc1_test5, 2000, 20, "proc1_test5", 2, "WSCLOCK", 0));
+	sleep(5);
+	tlb_report("policies");
+
+	kprintf("\n6: sequential readahead\n");
+	resume(vcreate(proc1_test6, 2000, STREAM_PAGES + 1, 20, "proc1_test6", 2,
+		"stream", 0));
+	sleep(3);
+	tlb_report("stream");
+
+	kprintf("\n7: copy-on-write vfork\n");
+	resume(vcreate(proc1_test7, 2000, FORK_PAGES + 1, 20, "proc1_test7", 2,
+		"vfork", 0));
+	sleep(3);
+	tlb_report("vfork");
+
+	kprintf("\n8: resident set quotas\n");
+	resume(vcreate(test8_hot, 2000, HOT_PAGES + 1, 20, "test8_hot", 2,
+		"hot", 0));
+	pid1 = vcreate(test8_hog, 2000, HOG_PAGES + 1, 20, "test8_hog", 2, "hog", 0);
+	rsslimit(pid1, HOG_QUOTA / 2, HOG_QUOTA);
+	resume(pid1);
+	sleep(4);
+
+	kprintf("\n9: shared xmmap page cache\n");
+	resume(create(test9_share, 2000, 20, "producer", 2, "producer", 0));
+	resume(create(test9_share, 2000, 20, "consumer", 2, "consumer", 1));
+	sleep(3);
+
+	kprintf("\n10: sparse 4MB heap\n");
+	resume(vcreate(test10_big, 2000, BIG_PAGES, 20, "test10_big", 2, "big", 0));
+	sleep(3);
+
+	kprintf("\n11: compressed swap tier\n");
+	pid1 = vcreate(test11_zswap, 2000, ZS_PAGES + 1, 20, "test11", 2, "on", 0);
+	rsslimit(pid1, ZS_QUOTA / 2, ZS_QUOTA);
+	resume(pid1);
+	sleep(3);
+	zswap(FALSE);
+	pid1 = vcreate(test11_zswap, 2000, ZS_PAGES + 1, 20, "test11", 2, "off", 0);
+	rsslimit(pid1, ZS_QUOTA / 2, ZS_QUOTA);
+	resume(pid1);
+	sleep(3);
+	zswap(TRUE);
+
+	kprintf("\n12: paging event trace\n");
+	trace(TR_ALL);
+	pid1 = vcreate(test12_traced, 2000, TR_PAGES + 1, 20, "test12", 2,
+		"traced", 0);
+	rsslimit(pid1, TR_QUOTA / 2, TR_QUOTA);
+	resume(create(test12_reader, 2000, 20, "reader", 2, "trace", pid1));
+	resume(pid1);
+	sleep(5);
+	trace(0);
+
+	kprintf("\n13: page table sharing\n");
+	resume(vcreate(test13_ptshare, 2000, FORK_PAGES + 1, 20, "test13", 2,
+		"ptshare", 0));
+	sleep(3);
+
+	kprintf("\n14: page zero and copy kernels\n");
+	resume(create(test14_kernels, 2000, 20, "test14", 2, "kernels", 0));
+	sleep(2);
+
+	kprintf("\n15: memory pressure notification\n");
+	resume(vcreate(test15_cache, 2000, BIG_PAGES, 20, "test15", 2,
+		"cache", 0));
+	sleep(5);
+
+	kprintf("\n16: access pattern hints\n");
+	resume(vcreate(test16_advise, 2000, 3 * ADV_PAGES + 2, 20, "test16", 2,
+		"advise", 0));
+	sleep(3);
+
+	kprintf("\n17: locked pages under memory pressure\n");
+	resume(vcreate(test17_lock, 2000, BIG_PAGES, 20, "test17", 2,
+		"lock", 0));
+	sleep(5);
+
+	kprintf("\n18: demand-paged stacks\n");
+	resume(vcreate(test18_stack, STK_BIG, 16, 20, "test18", 2,
+		"grow", STK_DEPTH));
+	sleep(2);
+	nover = stk_noverflow;
+	resume(vcreate(test18_stack, STK_SMALL, 16, 20, "test18", 2,
+		"overflow", STK_DEPTH));
+	sleep(2);
+	kprintf("overflow: %u killed at the guard page\n", stk_noverflow - nover);
+
+	kprintf("\n19: process teardown\n");
+	resume(create(test19_exit, 2000, 20, "test19", 2, "exit", 0));
+	sleep(3);
+
+	kprintf("\n20: page coloring\n");
+	resume(vcreate(test20_color, 2000, COLOR_PAGES + 1, 20, "test20", 2,
+		"colored", 0));
+	sleep(3);
+	frmcolor(FALSE);
+	resume(vcreate(test20_color, 2000, COLOR_PAGES + 1, 20, "test20", 2,
+		"uncolored", 0));
+	sleep(3);
+	frmcolor(TRUE);
 }
@@ -9,13 +9,28 @@ bs_map_t bsm_tab[MAX_BS];
 xmmap_entry_t xmmap_tab[MAX_XMMAP_ENTRIES];
 int xmmap_count = 0;
 
+/* The backing store area is one pool of BS_NCHUNKS chunks of BS_CHUNK
+ * pages.  A store owns no space until a page in it is first written;
+ * then the chunk covering that page is taken from the pool, so a store
+ * can be as large as BS_MAXPAGES and only pays for what it holds.
+ *
+ * Mapping a store reserves enough chunks to hold every page in the
+ * mapping, and the map is refused if the pool cannot cover that, so a
+ * page being evicted always has somewhere to go.  A store nobody maps
+ * keeps only what it holds, and only until a new mapping needs the space.
+ */
+static unsigned long bs_cmap[BS_NCHUNKS / 32];	/* bit set: chunk is free */
+int bs_nfree = 0;			/* free chunks in the pool	*/
+static int bs_nspare = 0;		/* chunks no store has reserved	*/
+
 /*-------------------------------------------------------------------------
  * init_bsm - initialize bsm_tab
  *-------------------------------------------------------------------------
  */
 SYSCALL init_bsm()
 {
-    int i;
+    int i, j;
+    zs_init();
     for (i = 0; i < MAX_BS; i++) {
         bsm_tab[i].bs_status = BSM_UNMAPPED;
         bsm_tab[i].bs_pid = -1;
@@ -23,12 +38,30 @@ SYSCALL init_bsm()
         bsm_tab[i].bs_npages = 0;
         bsm_tab[i].bs_sem = 0;
         bsm_tab[i].bs_type = BS_TYPE_VHEAP;
+        bsm_tab[i].bs_xmhead = -1;
+        bsm_tab[i].bs_nchunks = 0;
+        bsm_tab[i].bs_nresv = 0;
+        for (j = 0; j < BS_MAXPAGES / BS_CHUNK; j++) {
+            bsm_tab[i].bs_chunk[j] = -1;
+        }
+        for (j = 0; j < BS_MAXPAGES / 32; j++) {
+            bsm_tab[i].bs_zmap[j] = 0;
+        }
+    }
+    for (i = 0; i < BS_NCHUNKS / 32; i++) {
+        bs_cmap[i] = ~0UL;
+    }
+    bs_nfree = BS_NCHUNKS;
+    bs_nspare = BS_NCHUNKS;
+    for (i = 0; i < MAX_BS; i++) {
+        bs_clear(i);
     }
     for (i = 0; i < MAX_XMMAP_ENTRIES; i++) {
         xmmap_tab[i].xm_pid = -1;
         xmmap_tab[i].xm_vpno = 0;
         xmmap_tab[i].xm_npages = 0;
         xmmap_tab[i].xm_bs_id = -1;
+        xmmap_tab[i].xm_next = -1;
     }
     xmmap_count = 0;
     return OK;
@@ -76,7 +109,12 @@ SYSCALL free_bsm(int i)
     if (i < 0 || i >= MAX_BS) {
         return SYSERR;
     }
-    /* Free if mapped or already free */
+    /* Free if mapped or already free; a heap's contents die with it */
+    if (bsm_tab[i].bs_type == BS_TYPE_VHEAP) {
+        bs_clear(i);
+    } else {
+        bs_unreserve(i);
+    }
     bsm_tab[i].bs_status = BSM_UNMAPPED;
     bsm_tab[i].bs_pid = -1;
     bsm_tab[i].bs_vpno = 0;
@@ -86,6 +124,138 @@ SYSCALL free_bsm(int i)
     return OK;
 }
 
+/*-------------------------------------------------------------------------
+ * bs_clear - forget the contents of backing store bs_id and give its
+ * space back to the pool
+ *-------------------------------------------------------------------------
+ */
+void bs_clear(int bs_id)
+{
+    int i, c;
+    for (i = 0; i < BS_MAXPAGES; i++) {
+        zs_forget(bs_id, i);
+    }
+    for (i = 0; i < BS_MAXPAGES / 32; i++) {
+        bsm_tab[bs_id].bs_wmap[i] = 0;
+    }
+    for (i = 0; i < BS_MAXPAGES / BS_CHUNK; i++) {
+        if ((c = bsm_tab[bs_id].bs_chunk[i]) != -1) {
+            bs_cmap[c >> 5] |= 1UL << (c & 31);
+            bs_nfree++;
+            bsm_tab[bs_id].bs_chunk[i] = -1;
+        }
+    }
+    bsm_tab[bs_id].bs_nchunks = 0;
+    bs_nspare += bsm_tab[bs_id].bs_nresv;
+    bsm_tab[bs_id].bs_nresv = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * bs_reserve - make sure store bs_id has chunks set aside for pages 0 to
+ * npages - 1 on top of what it holds beyond them; SYSERR if the pool
+ * cannot cover it, even after clearing stores nobody maps
+ *-------------------------------------------------------------------------
+ */
+SYSCALL bs_reserve(int bs_id, int npages)
+{
+    int i, need;
+
+    need = (npages + BS_CHUNK - 1) / BS_CHUNK;
+    for (i = need; i < BS_MAXPAGES / BS_CHUNK; i++) {
+        if (bsm_tab[bs_id].bs_chunk[i] != -1) {
+            need++;
+        }
+    }
+    need -= bsm_tab[bs_id].bs_nresv;
+    if (need <= 0) {
+        return OK;
+    }
+
+    // Left-over xmmap contents go before a new mapping is turned away
+    for (i = 0; i < MAX_BS && bs_nspare < need; i++) {
+        if (i != bs_id && bsm_tab[i].bs_status == BSM_UNMAPPED &&
+            bsm_tab[i].bs_nresv > 0) {
+            bs_clear(i);
+        }
+    }
+    if (bs_nspare < need) {
+        return SYSERR;
+    }
+    bs_nspare -= need;
+    bsm_tab[bs_id].bs_nresv += need;
+    return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * bs_unreserve - nobody maps store bs_id any more; keep reserved only the
+ * chunks it holds
+ *-------------------------------------------------------------------------
+ */
+void bs_unreserve(int bs_id)
+{
+    bs_nspare += bsm_tab[bs_id].bs_nresv - bsm_tab[bs_id].bs_nchunks;
+    bsm_tab[bs_id].bs_nresv = bsm_tab[bs_id].bs_nchunks;
+}
+
+/*-------------------------------------------------------------------------
+ * bs_addr - return where page of backing store bs_id is kept, or NULL if
+ * no space was ever allocated for it
+ *-------------------------------------------------------------------------
+ */
+char *bs_addr(int bs_id, int page)
+{
+    int c = bsm_tab[bs_id].bs_chunk[page / BS_CHUNK];
+    if (c == -1) {
+        return NULL;
+    }
+    return (char *)(BACKING_STORE_BASE + (c * BS_CHUNK + page % BS_CHUNK) * NBPG);
+}
+
+/*-------------------------------------------------------------------------
+ * bs_alloc - like bs_addr, but take a chunk from the pool for the page if
+ * it has none; NULL if the store has used up its reservation and the
+ * pool has nothing spare
+ *
+ * The chunk after the one holding the store's previous run is preferred,
+ * so that stores filled in order stay contiguous for vectored transfers.
+ *-------------------------------------------------------------------------
+ */
+char *bs_alloc(int bs_id, int page)
+{
+    int i, c, w;
+    unsigned long word;
+
+    i = page / BS_CHUNK;
+    if (bsm_tab[bs_id].bs_chunk[i] != -1) {
+        return bs_addr(bs_id, page);
+    }
+    // Within the reservation a free chunk is always there
+    if (bsm_tab[bs_id].bs_nchunks >= bsm_tab[bs_id].bs_nresv) {
+        if (bs_nspare == 0) {
+            return NULL;
+        }
+        bs_nspare--;
+        bsm_tab[bs_id].bs_nresv++;
+    }
+
+    c = -1;
+    if (i > 0 && (w = bsm_tab[bs_id].bs_chunk[i - 1]) != -1 &&
+        w + 1 < BS_NCHUNKS && (bs_cmap[(w + 1) >> 5] & (1UL << ((w + 1) & 31)))) {
+        c = w + 1;
+    }
+    for (w = 0; c == -1 && w < BS_NCHUNKS / 32; w++) {
+        if ((word = bs_cmap[w]) != 0) {
+            __asm__ ("bsfl %1, %0" : "=r"(c) : "rm"(word));
+            c += w << 5;
+        }
+    }
+    bs_cmap[c >> 5] &= ~(1UL << (c & 31));
+    bs_nfree--;
+    bsm_tab[bs_id].bs_chunk[i] = (short)c;
+    bsm_tab[bs_id].bs_nchunks++;
+    return bs_addr(bs_id, page);
+}
+
 /*-------------------------------------------------------------------------
  * bsm_lookup - find the backing store and page corresponding to the given
  * pid and vaddr.
@@ -104,29 +274,21 @@ SYSCALL free_bsm(int i)
  */
 SYSCALL bsm_lookup(int pid, long vaddr, int* store, int* pageth)
 {
-    int i;
+    vregion_t *vr;
     unsigned long vpno;
     if (isbadpid(pid)) {
         return SYSERR;
     }
     vpno = ((unsigned long)vaddr) >> 12;
     
-    // Check VHEAP mappings (exclusive ownership)
-    for (i = 0; i < MAX_BS; i++) {
-        if (bsm_tab[i].bs_status == BSM_MAPPED && 
-            bsm_tab[i].bs_type == BS_TYPE_VHEAP && 
-            bsm_tab[i].bs_pid == pid) {
-            int start = bsm_tab[i].bs_vpno;
-            int count = bsm_tab[i].bs_npages;
-            if ((int)vpno >= start && (int)vpno < (start + count)) {
-                if (store) *store = i;
-                if (pageth) *pageth = (int)vpno - start;
-                return OK;
-            }
-        }
+    // VHEAP mappings are kept in the per-process region index
+    vr = vr_lookup(pid, (int)vpno);
+    if (vr == NULL || vr->vr_type != BS_TYPE_VHEAP) {
+        return SYSERR;
     }
-    
-    return SYSERR;
+    if (store) *store = vr->vr_bs_id;
+    if (pageth) *pageth = (int)vpno - vr->vr_vpno;
+    return OK;
 }
 
 
@@ -137,7 +299,10 @@ SYSCALL bsm_lookup(int pid, long vaddr, int* store, int* pageth)
  */
 SYSCALL bsm_map(int pid, int vpno, int source, int npages)
 {
-    if (isbadpid(pid) || source < 0 || source >= MAX_BS || npages <= 0 || npages > 256) {
+    int remap;
+
+    if (isbadpid(pid) || source < 0 || source >= MAX_BS || npages <= 0 ||
+        npages > BS_MAXPAGES) {
         return SYSERR;
     }
 
@@ -157,7 +322,33 @@ SYSCALL bsm_map(int pid, int vpno, int source, int npages)
         return SYSERR;
     }
 
-     // Map backing store for this process's VHEAP (exclusive ownership)
+    // A store taken fresh starts out as a zero-filled heap, and every
+    // page of the heap needs somewhere to go when it is evicted
+    if (bsm_tab[source].bs_status != BSM_MAPPED) {
+        bs_clear(source);
+    }
+    if (bs_reserve(source, npages) == SYSERR) {
+        return SYSERR;
+    }
+
+    // Re-mapping by the same owner replaces its old region, which comes
+    // back if the new one does not fit; the new range may overlap it
+    remap = bsm_tab[source].bs_status == BSM_MAPPED &&
+            bsm_tab[source].bs_pid == pid;
+    if (remap) {
+        vr_remove(pid, bsm_tab[source].bs_vpno);
+    }
+    if (vr_insert(pid, vpno, npages, source, BS_TYPE_VHEAP, -1) == SYSERR) {
+        if (remap) {
+            vr_insert(pid, bsm_tab[source].bs_vpno, bsm_tab[source].bs_npages,
+                      source, BS_TYPE_VHEAP, -1);
+        } else {
+            bs_clear(source);
+        }
+        return SYSERR;
+    }
+
+    // Map backing store for this process's VHEAP (exclusive ownership)
     bsm_tab[source].bs_status = BSM_MAPPED;
     bsm_tab[source].bs_type = BS_TYPE_VHEAP;
     bsm_tab[source].bs_pid = pid;
@@ -184,6 +375,7 @@ SYSCALL bsm_unmap(int pid, int vpno)
             bsm_tab[i].bs_type == BS_TYPE_VHEAP &&
             bsm_tab[i].bs_pid == pid && 
             bsm_tab[i].bs_vpno == vpno) {
+            vr_remove(pid, vpno);
             bsm_tab[i].bs_status = BSM_UNMAPPED;
             bsm_tab[i].bs_pid = -1;
             bsm_tab[i].bs_vpno = 0;
@@ -210,24 +402,57 @@ SYSCALL bsm_unmap(int pid, int vpno)
  */
 SYSCALL xmmap_lookup(int pid, long vaddr, int* store, int* pageth)
 {
-    int i;
+    vregion_t *vr;
     unsigned long vpno;
     if (isbadpid(pid)) {
         return SYSERR;
     }
     vpno = ((unsigned long)vaddr) >> 12;
     
-    // Check xmmap mappings (shared backing stores)
-    for (i = 0; i < xmmap_count; i++) {
-        if (xmmap_tab[i].xm_pid == pid &&
-            (int)vpno >= xmmap_tab[i].xm_vpno &&
-            (int)vpno < xmmap_tab[i].xm_vpno + xmmap_tab[i].xm_npages) {
-            if (store) *store = xmmap_tab[i].xm_bs_id;
-            if (pageth) *pageth = (int)vpno - xmmap_tab[i].xm_vpno;
+    // xmmap mappings are kept in the per-process region index
+    vr = vr_lookup(pid, (int)vpno);
+    if (vr == NULL || vr->vr_type != BS_TYPE_XMMAP) {
+        return SYSERR;
+    }
+    if (store) *store = vr->vr_bs_id;
+    if (pageth) *pageth = (int)vpno - vr->vr_vpno;
+    return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * xm_link - put xmmap_tab entry idx on its backing store's mapper chain
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xm_link(int idx)
+{
+    int bs_id = xmmap_tab[idx].xm_bs_id;
+    if (bs_id < 0 || bs_id >= MAX_BS) {
+        return SYSERR;
+    }
+    xmmap_tab[idx].xm_next = bsm_tab[bs_id].bs_xmhead;
+    bsm_tab[bs_id].bs_xmhead = idx;
+    return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * xm_unlink - take xmmap_tab entry idx off its backing store's mapper chain
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xm_unlink(int idx)
+{
+    int bs_id = xmmap_tab[idx].xm_bs_id;
+    int *link;
+    if (bs_id < 0 || bs_id >= MAX_BS) {
+        return SYSERR;
+    }
+    for (link = &bsm_tab[bs_id].bs_xmhead; *link != -1;
+         link = &xmmap_tab[*link].xm_next) {
+        if (*link == idx) {
+            *link = xmmap_tab[idx].xm_next;
+            xmmap_tab[idx].xm_next = -1;
             return OK;
         }
     }
-    
     return SYSERR;
 }
 
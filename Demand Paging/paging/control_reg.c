@@ -1,8 +1,9 @@
 /* control_reg.c - read_cr0 read_cr2 read_cr3 read_cr4
-		   write_cr0 write_cr3 write_cr4 enable_pagine */
+		   write_cr0 write_cr3 write_cr4 enable_pagine cpu_features */
 
 #include <conf.h>
 #include <kernel.h>
+#include <paging.h>
 
 unsigned long tmp;
 
@@ -183,8 +184,26 @@ void write_cr4(unsigned long n) {
 void enable_paging(){
   
   unsigned long temp =  read_cr0();
-  temp = temp | ( 0x1 << 31 ) | 0x1;
+  // WP (bit 16) makes kernel-mode writes honour read-only PTEs, which
+  // copy-on-write depends on since every process runs in ring 0
+  temp = temp | ( 0x1 << 31 ) | ( 0x1 << 16 ) | 0x1;
   write_cr0(temp); 
+
+  // Entries marked global (the identity map) now survive CR3 reloads
+  if (cpu_features() & CPUID_PGE) {
+    write_cr4(read_cr4() | CR4_PGE);
+  }
 }
 
 
+/*-------------------------------------------------------------------------
+ * cpu_features - return the CPUID leaf 1 feature flags (EDX)
+ *-------------------------------------------------------------------------
+ */
+unsigned long cpu_features(void) {
+
+  unsigned long a, b, c, d;
+
+  asm volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1));
+  return d;
+}
@@ -7,13 +7,44 @@
 /* Inverted page table (frame table) */
 fr_map_t frm_tab[NFRAMES];
 
-/* Second-Chance page replacement queue */
-static int sc_next[NFRAMES];  /* next frame index in circular queue */
-static int sc_head = -1;      /* head of circular queue (-1 if empty) */
-static int sc_count = 0;      /* number of frames in queue */
+/* Number of FRM_UNMAPPED frames get_frm() may hand out */
+int frm_nfree = 0;
+
+/* Free frame bitmap: bit i is set while frame i is on the free pool.
+ * frm_fhint is the lowest word that can have a bit set, so an allocation
+ * is a bsf on the first nonzero word instead of a walk over frm_tab.
+ */
+static unsigned long frm_fmap[NFRAMES / 32];
+static int frm_fhint = 0;
+
+/* Page coloring: a frame's color is its frame number modulo FRM_NCOLOR,
+ * the number of page-sized sets in the L2 cache.  Giving virtual page
+ * vpno a frame of color vpno % FRM_NCOLOR keeps consecutive pages of a
+ * region in different cache sets.  frm_cmask[c] has the bits of color c
+ * in each word of frm_fmap; a frame of another color is used when the
+ * pool has none of the one wanted.  Coloring is off while replacement
+ * debugging is on.
+ */
+int frm_color = 1;			/* allocate by color		*/
+unsigned long frm_ncolored = 0;		/* got the color asked for	*/
+unsigned long frm_nuncolored = 0;	/* settled for another one	*/
+static unsigned long frm_cmask[FRM_NCOLOR];
+
+/* Free frames the reclaim pass keeps ready for page faults */
+int frm_reserve = FRM_RESERVE;
+unsigned long frm_nreclaim = 0;		/* victims taken by the daemon	*/
+unsigned long frm_nstall = 0;		/* victims taken on the fault path */
+unsigned long frm_nlocal = 0;		/* victims taken from the faulter */
+
+/* Eviction rate behind frm_pressure(), in evictions per PP_WINDOW ms */
+static unsigned long frm_nevict = 0;
+static unsigned long frm_evlast = 0;
+static unsigned long frm_evtime = 0;
+static unsigned long frm_evrate = 0;
 
 /* Debug flag for page replacement */
 extern int pr_debug_flag;
+extern unsigned long ctr1000;
 
 /*-------------------------------------------------------------------------
  * init_frm - initialize frm_tab (the inverted page table)
@@ -29,475 +60,205 @@ SYSCALL init_frm()
     frm_tab[i].fr_refcnt = 0;
     frm_tab[i].fr_type = FR_PAGE;
     frm_tab[i].fr_dirty = 0;
-    sc_next[i] = -1;  /* Initialize queue pointers */
+    frm_tab[i].fr_bs = -1;
+    frm_tab[i].fr_bspage = 0;
+    frm_tab[i].fr_nshare = 0;
+    frm_tab[i].fr_pin = 0;
   }
-  sc_head = -1;
-  sc_count = 0;
-  return OK;
-}
-
-static SYSCALL write_dirty_page(int pid, int vpno, int frm_idx)
-{
-  unsigned long vaddr;
-  int store, pageth;
-  unsigned long page_phys_addr;
-  pd_t *pd;
-  pt_t *pt;
-  unsigned int pd_idx, pt_idx;
-  int i;
-  int xmmap_found = 0;
-  int heap_found = 0;
-  
-  // Calculate virtual address
-  vaddr = (unsigned long)vpno << 12;
-  
-  // Get page directory and page table
-  pd = (pd_t *) proctab[pid].pdbr;
-  pd_idx = (vaddr >> 22) & 0x3FF;
-  pt_idx = (vaddr >> 12) & 0x3FF;
-  
-  if (!pd[pd_idx].pd_pres) {
-    kprintf("write_dirty_page: Page directory entry not present for pid %d\n", pid);
-    return SYSERR;
+  for (i = 0; i < NFRAMES / 32; i++) {
+    frm_fmap[i] = 0;
   }
-  
-  pt = (pt_t *)(pd[pd_idx].pd_base << 12);
-  if (!pt[pt_idx].pt_pres) {
-    kprintf("write_dirty_page: Page table entry not present for pid %d\n", pid);
-    return SYSERR;
-  }
-  
-  // Get physical address of the frame
-  page_phys_addr = (FRAME0 + frm_idx) * NBPG;
-  
-  // Check xmmap mappings (shared backing stores)
-  for (i = 0; i < xmmap_count; i++) {
-    if (xmmap_tab[i].xm_pid == pid &&
-        (int)vpno >= xmmap_tab[i].xm_vpno &&
-        (int)vpno < xmmap_tab[i].xm_vpno + xmmap_tab[i].xm_npages) {
-      store = xmmap_tab[i].xm_bs_id;
-      pageth = (int)vpno - xmmap_tab[i].xm_vpno;
-      
-      // Write to xmmap backing store
-      if (write_bs((char *)page_phys_addr, (bsd_t)store, pageth) == SYSERR) {
-        kprintf("write_dirty_page: write_bs failed for xmmap pid %d store %d page %d\n", pid, store, pageth);
-        return SYSERR;
-      }
-      xmmap_found = 1;
-    }
+  // Frames 0-4 are claimed for the global PTs and NULL PD during boot
+  for (i = 5; i < NFRAMES; i++) {
+    frm_fmap[i >> 5] |= 1UL << (i & 31);
   }
-  
-  // Check VHEAP mappings
-  for (i = 0; i < MAX_BS; i++) {
-    if (bsm_tab[i].bs_status == BSM_MAPPED && 
-        bsm_tab[i].bs_type == BS_TYPE_VHEAP && 
-        bsm_tab[i].bs_pid == pid) {
-      int start = bsm_tab[i].bs_vpno;
-      int count = bsm_tab[i].bs_npages;
-      if ((int)vpno >= start && (int)vpno < (start + count)) {
-        store = i;
-        pageth = (int)vpno - start;
-        
-        // Write to VHEAP backing store
-        if (write_bs((char *)page_phys_addr, (bsd_t)store, pageth) == SYSERR) {
-          kprintf("write_dirty_page: write_bs failed for VHEAP pid %d store %d page %d\n", pid, store, pageth);
-          return SYSERR;
-        }
-        heap_found = 1;
-      }
-    }
+  frm_fhint = 0;
+  frm_nfree = NFRAMES - 5;
+  for (i = 0; i < FRM_NCOLOR; i++) {
+    frm_cmask[i] = 0;
   }
-  
-  if (!xmmap_found && !heap_found) {
-    kprintf("write_dirty_page: No backing store mapping for pid %d vpno %d\n", pid, vpno);
-    return SYSERR;
+  for (i = 0; i < 32; i++) {
+    frm_cmask[(FRAME0 + i) % FRM_NCOLOR] |= 1UL << i;
   }
-  
+  rss_init();
+  pc_init();
+  pr_curr->pp_init();
   return OK;
 }
 
 /*-------------------------------------------------------------------------
- * sync_bs_page - write back any dirty pages that map to the given backing
- * store page. This is needed for shared xmmap pages to ensure consistency.
- * Also invalidates the current process's page if present (unless it's dirty),
- * so it will be reloaded with the latest data from backing store.
- * 
- * Returns OK if successful, SYSERR otherwise.
+ * frm_claim - mark frame i allocated to currpid as an empty page frame
  *-------------------------------------------------------------------------
  */
-SYSCALL sync_bs_page(int store, int pageth, int curr_vpno)
+static void frm_claim(int i)
 {
-  int i;
-  int pid, vpno;
-  pd_t *pd;
-  pt_t *pt;
-  unsigned int pd_idx, pt_idx;
-  unsigned long vaddr;
-  int frm_idx;
-  int wrote_back = 0;
-  
-  // Check all xmmap mappings to find processes that might have this BS page dirty
-  for (i = 0; i < xmmap_count; i++) {
-    if (xmmap_tab[i].xm_bs_id == store && xmmap_tab[i].xm_pid != -1) {
-      pid = xmmap_tab[i].xm_pid;
-      
-      // Calculate which virtual page in this mapping corresponds to pageth
-      vpno = xmmap_tab[i].xm_vpno + pageth;
-      
-      // Check if this virtual page is within the mapping range
-      if (pageth >= 0 && pageth < xmmap_tab[i].xm_npages) {
-        vaddr = (unsigned long)vpno << 12;
-        pd_idx = (vaddr >> 22) & 0x3FF;
-        pt_idx = (vaddr >> 12) & 0x3FF;
-        
-        // Get page directory
-        pd = (pd_t *) proctab[pid].pdbr;
-        
-        if (pd[pd_idx].pd_pres) {
-          pt = (pt_t *)(pd[pd_idx].pd_base << 12);
-          
-          // Check if page is present and dirty
-          if (pt[pt_idx].pt_pres && pt[pt_idx].pt_dirty) {
-            // Find the frame index
-            frm_idx = (int)pt[pt_idx].pt_base - FRAME0;
-            
-            if (frm_idx >= 0 && frm_idx < NFRAMES) {
-              // Write dirty page back to backing store
-              if (write_dirty_page(pid, vpno, frm_idx) == SYSERR) {
-                kprintf("sync_bs_page: Failed to write dirty page for pid %d vpno %d\n", pid, vpno);
-                return SYSERR;
-              }
-              
-              // Clear dirty bit after successful write
-              pt[pt_idx].pt_dirty = 0;
-              if (frm_tab[frm_idx].fr_status == FRM_MAPPED) {
-                frm_tab[frm_idx].fr_dirty = 0;
-              }
-              wrote_back = 1;
-            }
-          }
-        }
-      }
-    }
-  }
-  
-  // If we wrote back pages, invalidate ALL processes' pages for this backing store page
-  // (except those that are dirty, meaning they have the latest version)
-  // This ensures that when any process accesses this page, it will be reloaded with latest data
-  if (wrote_back) {
-    // Go through all xmmap mappings for this backing store page and invalidate
-    // non-dirty pages so they'll be reloaded
-    for (i = 0; i < xmmap_count; i++) {
-      if (xmmap_tab[i].xm_bs_id == store && xmmap_tab[i].xm_pid != -1) {
-        pid = xmmap_tab[i].xm_pid;
-        
-        // Calculate which virtual page in this mapping corresponds to pageth
-        vpno = xmmap_tab[i].xm_vpno + pageth;
-        
-        // Check if this virtual page is within the mapping range
-        if (pageth >= 0 && pageth < xmmap_tab[i].xm_npages) {
-          vaddr = (unsigned long)vpno << 12;
-          pd_idx = (vaddr >> 22) & 0x3FF;
-          pt_idx = (vaddr >> 12) & 0x3FF;
-          
-          // Get page directory
-          pd = (pd_t *) proctab[pid].pdbr;
-          
-          if (pd[pd_idx].pd_pres) {
-            pt = (pt_t *)(pd[pd_idx].pd_base << 12);
-            
-            // If page is present and not dirty, invalidate it to force reload
-            if (pt[pt_idx].pt_pres && !pt[pt_idx].pt_dirty) {
-              int old_frm_idx = (int)pt[pt_idx].pt_base - FRAME0;
-              pt[pt_idx].pt_pres = 0;
-              
-              // Decrement reference count of old frame
-              if (old_frm_idx >= 0 && old_frm_idx < NFRAMES) {
-                frm_tab[old_frm_idx].fr_refcnt--;
-                if (frm_tab[old_frm_idx].fr_refcnt == 0) {
-                  frm_tab[old_frm_idx].fr_status = FRM_UNMAPPED;
-                  frm_tab[old_frm_idx].fr_pid = -1;
-                  frm_tab[old_frm_idx].fr_vpno = 0;
-                  frm_tab[old_frm_idx].fr_type = FR_PAGE;
-                  frm_tab[old_frm_idx].fr_dirty = 0;
-                }
-              }
-              
-              // Decrement page table reference count
-              int pt_frm_idx = (int)pd[pd_idx].pd_base - FRAME0;
-              if (pt_frm_idx >= 0 && pt_frm_idx < NFRAMES) {
-                frm_tab[pt_frm_idx].fr_refcnt--;
-                if (frm_tab[pt_frm_idx].fr_refcnt == 0) {
-                  pd[pd_idx].pd_pres = 0;
-                }
-              }
-              
-              // Invalidate TLB for this process
-              // Note: We need to switch to this process's context to invalidate its TLB
-              // But that's complex, so we'll invalidate all TLBs
-              invltlb(0);
-            }
-          }
-        }
-      }
-    }
-  }
-  
-  return OK;
+  frm_tab[i].fr_status = FRM_MAPPED;
+  frm_tab[i].fr_pid = currpid;
+  frm_tab[i].fr_vpno = 0;
+  frm_tab[i].fr_refcnt = 0;
+  frm_tab[i].fr_type = FR_PAGE;
+  frm_tab[i].fr_dirty = 0;
+  frm_tab[i].fr_bs = -1;
+  frm_tab[i].fr_bspage = 0;
+  frm_tab[i].fr_nshare = 0;
+  frm_tab[i].fr_pin = 0;
 }
 
 /*-------------------------------------------------------------------------
- * add_to_sc_queue - add a frame to the Second-Chance circular queue
+ * frm_writeback - write resident page frame frm_idx to its backing store
+ * if it is dirty, and mark it clean
+ *
+ * The dirty resident pages that directly follow it in the same region and
+ * page table go out in the same write_bs_v(), so a run of dirty pages
+ * costs one copy per physically contiguous stretch instead of one each.
  *-------------------------------------------------------------------------
  */
-void add_to_sc_queue(int frm_idx)
+SYSCALL frm_writeback(int frm_idx)
 {
-  /* Check if frame is already in queue */
-  if (sc_next[frm_idx] != -1) {
-    return;  /* Already in queue */
+  bsvec_t vec[WB_CLUSTER];
+  tlbbatch_t tb;
+  pt_t *pte;
+  vregion_t *vr;
+  int pid, vpno, v, f, n, k;
+
+  if ((pte = frm_pte(frm_idx)) == NULL) {
+    return SYSERR;
   }
-  
-  if (sc_head == -1) {
-    /* Queue is empty, initialize */
-    sc_head = frm_idx;
-    sc_next[frm_idx] = frm_idx;  /* Point to itself (circular) */
-    sc_count = 1;
-  } else {
-    /* Add to end of queue (before head) */
-    int current = sc_head;
-    /* Find the last element (points to head) */
-    while (sc_next[current] != sc_head) {
-      current = sc_next[current];
+  // A page cache frame has one store page however many map it; a
+  // copy-on-write frame belongs in every sharer's store
+  if (frm_tab[frm_idx].fr_refcnt > 1) {
+    if (frm_tab[frm_idx].fr_bs != -1) {
+      return pc_writeback(frm_idx);
+    }
+    return cow_writeback(frm_idx);
+  }
+  if (!pte->pt_dirty && !frm_tab[frm_idx].fr_dirty) {
+    return OK;
+  }
+
+  pid = frm_tab[frm_idx].fr_pid;
+  vpno = frm_tab[frm_idx].fr_vpno;
+  if ((vr = vr_lookup(pid, vpno)) == NULL) {
+    kprintf("frm_writeback: No backing store mapping for pid %d vpno %d\n", pid, vpno);
+    return SYSERR;
+  }
+
+  vec[0].bv_page = vpno - vr->vr_vpno;
+  vec[0].bv_frm = frm_idx;
+  for (n = 1, v = vpno + 1; n < WB_CLUSTER && (v & 0x3FF) != 0 &&
+       v < vr->vr_vpno + vr->vr_npages; n++, v++) {
+    f = (int)pte[n].pt_base - FRAME0;
+    if (!pte[n].pt_pres || f < 0 || f >= NFRAMES ||
+        frm_tab[f].fr_pid != pid || frm_tab[f].fr_vpno != v ||
+        frm_tab[f].fr_refcnt > 1 ||
+        !(pte[n].pt_dirty || frm_tab[f].fr_dirty)) {
+      break;
     }
-    /* Insert new frame after last element, before head */
-    sc_next[frm_idx] = sc_head;
-    sc_next[current] = frm_idx;
-    sc_count++;
+    vec[n].bv_page = v - vr->vr_vpno;
+    vec[n].bv_frm = f;
   }
+
+  if (write_bs_v((bsd_t)vr->vr_bs_id, vec, n) == SYSERR) {
+    kprintf("frm_writeback: write_bs_v failed for pid %d store %d page %d\n",
+            pid, vr->vr_bs_id, vec[0].bv_page);
+    return SYSERR;
+  }
+  pg_paged_out(pid, n);
+  tr_event(TR_WB, pid, vpno, n);
+
+  // A cached translation would let later writes skip setting pt_dirty
+  tlb_begin(&tb);
+  for (k = 0; k < n; k++) {
+    pte[k].pt_dirty = 0;
+    frm_tab[vec[k].bv_frm].fr_dirty = 0;
+    tlb_add(&tb, pid, (unsigned long)(vpno + k) << 12);
+  }
+  tlb_flush(&tb);
+  return OK;
 }
 
 /*-------------------------------------------------------------------------
- * remove_from_sc_queue - remove a frame from the Second-Chance queue
+ * frmcolor - turn page coloring on or off for frames allocated from now on
  *-------------------------------------------------------------------------
  */
-static void remove_from_sc_queue(int frm_idx)
+SYSCALL frmcolor(int on)
 {
-  if (sc_head == -1) {
-    return;  /* Queue is empty */
-  }
-  
-  if (sc_next[frm_idx] == -1) {
-    return;  /* Frame not in queue */
-  }
-  
-  if (sc_count == 1) {
-    /* Only one element */
-    sc_head = -1;
-    sc_next[frm_idx] = -1;
-    sc_count = 0;
-    return;
-  }
-  
-  /* Find previous element */
-  int current = sc_head;
-  while (sc_next[current] != frm_idx) {
-    current = sc_next[current];
-    if (current == sc_head) {
-      /* Frame not found in queue */
-      return;
-    }
-  }
-  
-  /* Remove from queue */
-  sc_next[current] = sc_next[frm_idx];
-  if (sc_head == frm_idx) {
-    sc_head = sc_next[frm_idx];
-  }
-  sc_next[frm_idx] = -1;
-  sc_count--;
+  frm_color = on ? 1 : 0;
+  return OK;
 }
 
 /*-------------------------------------------------------------------------
- * evict_frame - Second-Chance page replacement algorithm
- * 
- * Returns the frame index to evict, or SYSERR if no frame can be evicted.
+ * frm_pop - take the lowest numbered frame off the free pool, or SYSERR;
+ * with coloring on, the lowest one of the color for vpno if there is one
  *-------------------------------------------------------------------------
  */
-static int evict_frame(void)
+static int frm_pop(int vpno)
 {
-  int candidate;
-  int start;
-  int pid, vpno;
-  unsigned long vaddr;
-  unsigned int pd_idx, pt_idx;
-  pd_t *pd;
-  pt_t *pt;
-  
-  if (sc_head == -1) {
-    int i;
-    for (i = 5; i < NFRAMES; i++) {
-      if (frm_tab[i].fr_status == FRM_MAPPED && frm_tab[i].fr_type == FR_PAGE) {
-        return i;
+  unsigned long word, mask;
+  int w, bit;
+
+  // Debug runs expect frames lowest first, as in their printed victims
+  if (frm_color && !pr_debug_flag && vpno >= 0) {
+    mask = frm_cmask[vpno % FRM_NCOLOR];
+    for (w = frm_fhint; w < NFRAMES / 32; w++) {
+      if ((word = frm_fmap[w] & mask) != 0) {
+        __asm__ ("bsfl %1, %0" : "=r"(bit) : "rm"(word));
+        frm_fmap[w] &= ~(1UL << bit);
+        frm_ncolored++;
+        return (w << 5) + bit;
       }
     }
-    return SYSERR;
+    frm_nuncolored++;
   }
-  
-  start = sc_head;
-  candidate = sc_head;
-  
-  int first_pass = 1;
-  int iterations = 0;
-  int max_iterations = sc_count * 2 + 10;  
-  
-  do {
-    iterations++;
-    if (iterations > max_iterations) {
-      break;
-    }
-    
-    pid = frm_tab[candidate].fr_pid;
-    vpno = frm_tab[candidate].fr_vpno;
-    
-    if (pid == -1 || frm_tab[candidate].fr_status != FRM_MAPPED || 
-        frm_tab[candidate].fr_type != FR_PAGE) {
-      int next = sc_next[candidate];
-      if (next == -1 || next == candidate) {
-        break;
-      }
-      candidate = next;
-      if (candidate == start) {
-        if (!first_pass) {
-          break;
-        }
-        first_pass = 0;
-      }
-      continue;
-    }
-    
-    vaddr = (unsigned long)vpno << 12;
-    pd_idx = (vaddr >> 22) & 0x3FF;
-    pt_idx = (vaddr >> 12) & 0x3FF;
-    
-    pd = (pd_t *) proctab[pid].pdbr;
-    if (!pd || !pd[pd_idx].pd_pres) {
-      int next = sc_next[candidate];
-      if (next == -1 || next == candidate) {
-        break;
-      }
-      candidate = next;
-      if (candidate == start) {
-        if (!first_pass) {
-          break;
-        }
-        first_pass = 0;
-      }
-      continue;
-    }
-    
-    pt = (pt_t *)(pd[pd_idx].pd_base << 12);
-    if (!pt || !pt[pt_idx].pt_pres) {
-      /* Skip if page table entry not present */
-      int next = sc_next[candidate];
-      if (next == -1 || next == candidate) {
-        break;
-      }
-      candidate = next;
-      if (candidate == start) {
-        if (!first_pass) {
-          break;
-        }
-        first_pass = 0;
-      }
-      continue;
-    }
-    
-    if (!pt[pt_idx].pt_acc) {
-      int next = sc_next[candidate];
-      if (next != -1 && next != candidate) {
-        sc_head = next;
-      } else {
-        sc_head = -1;
-      }
-      return candidate;
-    }
-    
-    /* Clear the reference bit */
-    pt[pt_idx].pt_acc = 0;
-    
-    int next = sc_next[candidate];
-    if (next == -1 || next == candidate) {
-      break;
-    }
-    candidate = next;
-    
-    sc_head = candidate;
-    
-    if (candidate == start) {
-      if (!first_pass) {
-        break;
-      }
-      first_pass = 0;  
-    }
-    
-  } while (1);
 
-  if (candidate >= 0 && candidate < NFRAMES &&
-      frm_tab[candidate].fr_status == FRM_MAPPED &&
-      frm_tab[candidate].fr_type == FR_PAGE) {
-    return candidate;
-  }
-  
-  int i;
-  for (i = 5; i < NFRAMES; i++) {
-    if (frm_tab[i].fr_status == FRM_MAPPED && frm_tab[i].fr_type == FR_PAGE) {
-      return i;
+  for (w = frm_fhint; w < NFRAMES / 32; w++) {
+    if ((word = frm_fmap[w]) != 0) {
+      __asm__ ("bsfl %1, %0" : "=r"(bit) : "rm"(word));
+      frm_fmap[w] &= ~(1UL << bit);
+      frm_fhint = w;
+      return (w << 5) + bit;
     }
   }
-  
+  frm_fhint = NFRAMES / 32;
   return SYSERR;
 }
 
 /*-------------------------------------------------------------------------
- * get_frm - get a free frame according page replacement policy
- * 
- * out variables: avail
- * 
- * If a frame is available, return OK and set avail to the available frame.
- * 
- * If no frames are available, return SYSERR and set avail to any value or 
- * not set it at all, since callers should always check the return code prior 
- * to making use of out variables.
+ * frm_evict - unmap victim page frame evict_idx from its owner, writing it
+ * back first if it is dirty, and return it to the free pool
  *-------------------------------------------------------------------------
  */
-SYSCALL get_frm(int* avail)
+static SYSCALL frm_evict(int evict_idx)
 {
-  int i;
-  int evict_idx;
   int evict_pid, evict_vpno;
   unsigned long evict_vaddr;
   unsigned int pd_idx, pt_idx;
   pd_t *pd;
   pt_t *pt;
-  int pt_frm_idx;
-  
-  // Skip frames 0-4 which are used for global PTs and NULL PD 
-  for (i = 5; i < NFRAMES; i++) {
-    if (frm_tab[i].fr_status == FRM_UNMAPPED) {
-      if (avail) *avail = i;
-      return OK;
-    }
-  }
-  
-  evict_idx = evict_frame();
-  if (evict_idx == SYSERR) {
-    return SYSERR;
+
+  pr_nevicts++;
+  frm_nevict++;
+  if ((pt = frm_pte(evict_idx)) != NULL) {
+    pr_nclass[2 * pt->pt_acc + (pt->pt_dirty || frm_tab[evict_idx].fr_dirty)]++;
   }
-  
+  proctab[currpid].pnevict++;
+  tr_event(TR_EVICT, frm_tab[evict_idx].fr_pid, frm_tab[evict_idx].fr_vpno, evict_idx);
   if (pr_debug_flag) {
     kprintf("%d\n", evict_idx);
   }
   
+  // A shared frame is unmapped from every process mapping it
+  if (frm_tab[evict_idx].fr_refcnt > 1) {
+    if (frm_tab[evict_idx].fr_bs != -1) {
+      if (pc_writeback(evict_idx) == SYSERR || pc_unmap(evict_idx) == SYSERR) {
+        return SYSERR;
+      }
+    } else if (cow_writeback(evict_idx) == SYSERR || cow_unmap(evict_idx) == SYSERR) {
+      return SYSERR;
+    }
+    return free_frm(evict_idx);
+  }
+  
   // Get information about the frame to evict
   evict_pid = frm_tab[evict_idx].fr_pid;
   evict_vpno = frm_tab[evict_idx].fr_vpno;
@@ -515,21 +276,15 @@ SYSCALL get_frm(int* avail)
   
   pt = (pt_t *)(pd[pd_idx].pd_base << 12);
   
-  // Check if page is dirty and write it back
-  if (pt[pt_idx].pt_dirty) {
-    // Also update frame table dirty bit
-    frm_tab[evict_idx].fr_dirty = 1;
-    
-    // Write dirty page back to backing store
-    if (write_dirty_page(evict_pid, evict_vpno, evict_idx) == SYSERR) {
+  // The daemon normally got here first; a dirty victim means it fell
+  // behind and whoever is evicting pays for the write
+  if (pt[pt_idx].pt_dirty || frm_tab[evict_idx].fr_dirty) {
+    if (frm_writeback(evict_idx) == SYSERR) {
       kprintf("get_frm: Failed to write dirty page for pid %d vpno %d\n", evict_pid, evict_vpno);
       kill(evict_pid);
       return SYSERR;
     }
-    
-    // Clear dirty bit in page table
-    pt[pt_idx].pt_dirty = 0;
-    frm_tab[evict_idx].fr_dirty = 0;
+    wb_nsync++;
   }
   
   // Mark page table entry as not present
@@ -540,27 +295,165 @@ SYSCALL get_frm(int* avail)
     invltlb(evict_vaddr);
   }
   
-  // Decrement reference count of page table frame
-  pt_frm_idx = (int)pd[pd_idx].pd_base - FRAME0;
-  if (pt_frm_idx >= 0 && pt_frm_idx < NFRAMES) {
-    frm_tab[pt_frm_idx].fr_refcnt--;
-    // If reference count reaches zero, mark page table as not present
-    if (frm_tab[pt_frm_idx].fr_refcnt == 0) {
-      pd[pd_idx].pd_pres = 0;
+  // Decrement reference count of page table frame; an emptied table is
+  // unhooked and left for pt_reclaim()
+  pt_unref(pd, pd_idx);
+  
+  return free_frm(evict_idx);
+}
+
+/*-------------------------------------------------------------------------
+ * frm_reclaim - evict pages chosen by the replacement policy until the
+ * free pool is back up to WB_LOWAT; run by the writeback daemon so that
+ * page faults find a free frame without running the policy scan
+ *-------------------------------------------------------------------------
+ */
+void frm_reclaim(void)
+{
+  STATWORD ps;
+  int victim;
+
+  // Empty page tables cost nothing to free, so they go first
+  disable(ps);
+  if (!pr_debug_flag && frm_nfree < WB_LOWAT) {
+    pt_reclaim();
+  }
+  restore(ps);
+
+  // Refilling past the reserve lets get_frm() take a batch of frames
+  // before it has to wake us again; debug output names victims at the
+  // fault that needed them
+  while (!pr_debug_flag && frm_nfree < WB_LOWAT) {
+    disable(ps);
+    if (frm_nfree >= WB_LOWAT || (victim = pr_evict()) == SYSERR ||
+        frm_evict(victim) == SYSERR) {
+      restore(ps);
+      return;
     }
+    frm_nreclaim++;
+    restore(ps);
   }
+}
+
+/*-------------------------------------------------------------------------
+ * frm_pressure - return how short of frames the system is, PP_NONE to
+ * PP_CRITICAL
+ *
+ * The level follows the free pool down past the daemon's watermarks to
+ * the reserve.  The daemon keeps the pool near WB_LOWAT however hard
+ * it has to evict, so an eviction rate of PP_EVRATE or more per
+ * PP_WINDOW ms raises the level by one as well.
+ *-------------------------------------------------------------------------
+ */
+int frm_pressure(void)
+{
+  STATWORD ps;
+  unsigned long now;
+  int level;
+
+  disable(ps);
+  now = ctr1000;
+  if (now - frm_evtime >= PP_WINDOW) {
+    // Average this window's rate into the last one
+    frm_evrate = (frm_evrate +
+                  (frm_nevict - frm_evlast) * PP_WINDOW / (now - frm_evtime)) / 2;
+    frm_evlast = frm_nevict;
+    frm_evtime = now;
+  }
+
+  if (frm_nfree >= WB_HIWAT) {
+    level = PP_NONE;
+  } else if (frm_nfree >= WB_LOWAT) {
+    level = PP_LOW;
+  } else if (frm_nfree > frm_reserve) {
+    level = PP_MEDIUM;
+  } else {
+    level = PP_CRITICAL;
+  }
+  if (frm_evrate >= PP_EVRATE && level < PP_CRITICAL) {
+    level++;
+  }
+  restore(ps);
+  return level;
+}
+
+/*-------------------------------------------------------------------------
+ * rss_trim - make room for a page-in by currpid inside its frame quota
+ *
+ * Over its hard quota a process always replaces one of its own pages.
+ * Over the soft quota it does so only once the free pool is down to the
+ * reserve, so it may use idle memory but not push others out to grow.
+ *-------------------------------------------------------------------------
+ */
+void rss_trim(void)
+{
+  struct pentry *pptr = &proctab[currpid];
+  int victim;
+
+  while (rss_over(currpid, pptr->prss_hard) ||
+         (rss_over(currpid, pptr->prss_soft) && frm_nfree <= frm_reserve)) {
+    if ((victim = rss_victim(currpid)) == SYSERR ||
+        frm_evict(victim) == SYSERR) {
+      return;
+    }
+    frm_nlocal++;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * get_frm - get a free frame according page replacement policy; see
+ * get_frm_vp()
+ *-------------------------------------------------------------------------
+ */
+SYSCALL get_frm(int* avail)
+{
+  return get_frm_vp(avail, -1);
+}
+
+/*-------------------------------------------------------------------------
+ * get_frm_vp - get a free frame for virtual page vpno, or for a page
+ * table or directory if vpno is -1
+ * 
+ * out variables: avail
+ * 
+ * If a frame is available, return OK and set avail to the available frame.
+ * The frame is claimed as a FR_PAGE of currpid; callers fill in the rest.
+ * 
+ * If no frames are available, return SYSERR and set avail to any value or 
+ * not set it at all, since callers should always check the return code prior 
+ * to making use of out variables.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL get_frm_vp(int* avail, int vpno)
+{
+  int i;
+  int evict_idx;
   
-  remove_from_sc_queue(evict_idx);
-  
-  // Clear the frame table entry
-  frm_tab[evict_idx].fr_status = FRM_UNMAPPED;
-  frm_tab[evict_idx].fr_pid = -1;
-  frm_tab[evict_idx].fr_vpno = 0;
-  frm_tab[evict_idx].fr_refcnt = 0;
-  frm_tab[evict_idx].fr_type = FR_PAGE;
-  frm_tab[evict_idx].fr_dirty = 0;
+  // Normally the reclaim pass keeps the pool stocked; evicting here only
+  // happens when the daemon has not caught up yet
+  if ((i = frm_pop(vpno)) == SYSERR) {
+    wb_kick();
+    evict_idx = pr_evict();
+    if (evict_idx == SYSERR || frm_evict(evict_idx) == SYSERR) {
+      return SYSERR;
+    }
+    frm_nstall++;
+    if ((i = frm_pop(vpno)) == SYSERR) {
+      return SYSERR;
+    }
+  }
   
-  if (avail) *avail = evict_idx;
+  frm_claim(i);
+  frm_nfree--;
+  // Let the daemon clean and reclaim ahead before we run out.  It refills
+  // to WB_LOWAT, so wake it once on the way down and then only when the
+  // batch it left is gone, not on every frame in between.  Dropping
+  // below WB_HIWAT wakes it too, so PP_LOW gets reported.
+  if (frm_nfree == WB_HIWAT - 1 || frm_nfree == WB_LOWAT - 1 ||
+      frm_nfree < frm_reserve) {
+    wb_kick();
+  }
+  if (avail) *avail = i;
   return OK;
 }
 
@@ -575,16 +468,28 @@ SYSCALL free_frm(int i)
     return SYSERR;
   }
   
-  remove_from_sc_queue(i);
+  pr_remove(i);
+  if (frm_tab[i].fr_bs != -1) {
+    pc_remove(i);
+  }
   
+  if (frm_tab[i].fr_status == FRM_MAPPED) {
+    // Pressure is over; let the daemon tell whoever was waiting
+    if (++frm_nfree == WB_HIWAT) {
+      wb_kick();
+    }
+    frm_fmap[i >> 5] |= 1UL << (i & 31);
+    if ((i >> 5) < frm_fhint) {
+      frm_fhint = i >> 5;
+    }
+  }
   frm_tab[i].fr_status = FRM_UNMAPPED;
   frm_tab[i].fr_pid = -1;
   frm_tab[i].fr_vpno = 0;
   frm_tab[i].fr_refcnt = 0;
   frm_tab[i].fr_type = FR_PAGE;
   frm_tab[i].fr_dirty = 0;
+  frm_tab[i].fr_nshare = 0;
+  frm_tab[i].fr_pin = 0;
   return OK;
 }
-
-
-
@@ -1,9 +1,18 @@
-/* invltlb.c - invalidate a TLB entry */
+/* invltlb.c - invalidate a TLB entry, tlb_add, tlb_flush */
 
 #include <conf.h>
 #include <kernel.h>
+#include <proc.h>
 #include <paging.h>
 
+extern unsigned long read_cr3(void);
+extern void write_cr3(unsigned long);
+
+/* How often each kind of invalidation happens */
+unsigned long tlb_npage = 0;		/* single entries, invlpg	*/
+unsigned long tlb_nfull = 0;		/* whole TLB, CR3 reload	*/
+unsigned long tlb_nswitch = 0;		/* CR3 loads in resched()	*/
+
 /*------------------------------------------------------------------------
  * invltlb - invalidate TLB entry for a given virtual address
  *------------------------------------------------------------------------
@@ -12,6 +21,49 @@ SYSCALL invltlb(unsigned long vaddr)
 {
 	/* Invalidate TLB entry using invlpg instruction */
 	asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+	tlb_npage++;
 	return OK;
 }
 
+/*------------------------------------------------------------------------
+ * tlb_add - note that pid's translation for vaddr changed
+ *
+ * Only the running address space can hold it: every other process gets a
+ * fresh TLB from the CR3 load when it is switched in.
+ *------------------------------------------------------------------------
+ */
+void tlb_add(tlbbatch_t *tb, int pid, unsigned long vaddr)
+{
+	if (pid != currpid) {
+		return;
+	}
+	if (tb->tb_n < TLB_NBATCH) {
+		tb->tb_vaddr[tb->tb_n] = vaddr;
+	}
+	tb->tb_n++;
+}
+
+/*------------------------------------------------------------------------
+ * tlb_flush - drop the translations collected in tb
+ *
+ * Up to TLB_FLUSH_MAX pages go one invlpg each; past that reloading CR3
+ * is cheaper, and the global kernel mappings survive it.
+ *------------------------------------------------------------------------
+ */
+void tlb_flush(tlbbatch_t *tb)
+{
+	int i;
+
+	if (tb->tb_n > 0) {
+		tr_event(TR_TLB, currpid, tb->tb_n, tb->tb_n > TLB_FLUSH_MAX);
+	}
+	if (tb->tb_n > TLB_FLUSH_MAX) {
+		write_cr3(read_cr3());
+		tlb_nfull++;
+	} else {
+		for (i = 0; i < tb->tb_n; i++) {
+			invltlb(tb->tb_vaddr[i]);
+		}
+	}
+	tb->tb_n = 0;
+}
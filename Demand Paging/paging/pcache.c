@@ -0,0 +1,226 @@
+/* pcache.c - shared page cache for xmmap backing stores */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* Every resident page of an xmmap store lives in exactly one frame,
+ * found by hashing (bs, page), and every process mapping that store
+ * page points its PTE at the same frame.  fr_refcnt counts the PTEs and
+ * fr_pid names one of the mappers, whose reference bit the replacement
+ * policies read and to which the frame is charged.  Writes by one mapper
+ * are seen by all the others directly, so nothing has to be written
+ * back or invalidated to keep them coherent.  The page is dirty if any
+ * mapper's PTE is, or if fr_dirty holds the dirt of a mapper that left.
+ */
+#define PC_NHASH	256
+#define pc_hash(bs, pg)	((((bs) * 31) + (pg)) & (PC_NHASH - 1))
+
+static int pc_head[PC_NHASH];		/* first cached frame, or -1	*/
+static int pc_next[NFRAMES];		/* next frame on the same chain	*/
+unsigned long pc_nhit = 0;		/* xmmap page-ins found cached	*/
+
+/*-------------------------------------------------------------------------
+ * pc_init - empty the page cache
+ *-------------------------------------------------------------------------
+ */
+void pc_init(void)
+{
+  int i;
+  for (i = 0; i < PC_NHASH; i++) {
+    pc_head[i] = -1;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * pc_lookup - return the frame caching page pageth of store bs, or -1
+ *-------------------------------------------------------------------------
+ */
+int pc_lookup(int bs, int pageth)
+{
+  int f;
+  for (f = pc_head[pc_hash(bs, pageth)]; f != -1; f = pc_next[f]) {
+    if (frm_tab[f].fr_bs == bs && frm_tab[f].fr_bspage == pageth) {
+      return f;
+    }
+  }
+  return -1;
+}
+
+/*-------------------------------------------------------------------------
+ * pc_insert - frame frm_idx now holds page pageth of store bs
+ *-------------------------------------------------------------------------
+ */
+void pc_insert(int frm_idx, int bs, int pageth)
+{
+  int h = pc_hash(bs, pageth);
+
+  pc_next[frm_idx] = pc_head[h];
+  pc_head[h] = frm_idx;
+  frm_tab[frm_idx].fr_bs = bs;
+  frm_tab[frm_idx].fr_bspage = pageth;
+}
+
+/*-------------------------------------------------------------------------
+ * pc_remove - frame frm_idx is being freed; forget what it cached
+ *-------------------------------------------------------------------------
+ */
+void pc_remove(int frm_idx)
+{
+  int *link;
+
+  for (link = &pc_head[pc_hash(frm_tab[frm_idx].fr_bs, frm_tab[frm_idx].fr_bspage)];
+       *link != -1; link = &pc_next[*link]) {
+    if (*link == frm_idx) {
+      *link = pc_next[frm_idx];
+      break;
+    }
+  }
+  frm_tab[frm_idx].fr_bs = -1;
+  frm_tab[frm_idx].fr_bspage = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * pc_pte - return the PTE through which mapping xm maps cached frame
+ * frm_idx, or NULL if it does not
+ *-------------------------------------------------------------------------
+ */
+static pt_t *pc_pte(int xm, int frm_idx)
+{
+  int vpno;
+  pd_t *pd;
+  pt_t *pt;
+
+  if (frm_tab[frm_idx].fr_bspage >= xmmap_tab[xm].xm_npages) {
+    return NULL;
+  }
+  vpno = xmmap_tab[xm].xm_vpno + frm_tab[frm_idx].fr_bspage;
+  pd = (pd_t *)proctab[xmmap_tab[xm].xm_pid].pdbr;
+  if (pd == NULL || !pd[(vpno >> 10) & 0x3FF].pd_pres) {
+    return NULL;
+  }
+  pt = (pt_t *)(pd[(vpno >> 10) & 0x3FF].pd_base << 12);
+  pt = &pt[vpno & 0x3FF];
+  if (!pt->pt_pres || (int)pt->pt_base != FRAME0 + frm_idx) {
+    return NULL;
+  }
+  return pt;
+}
+
+/*-------------------------------------------------------------------------
+ * pc_writeback - write cached frame frm_idx to its store page if any
+ * mapper dirtied it, and mark it clean everywhere
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pc_writeback(int frm_idx)
+{
+  int bs, xm, dirty;
+  pt_t *pte;
+  tlbbatch_t tb;
+
+  bs = frm_tab[frm_idx].fr_bs;
+  dirty = frm_tab[frm_idx].fr_dirty;
+  for (xm = bsm_tab[bs].bs_xmhead; xm != -1 && !dirty; xm = xmmap_tab[xm].xm_next) {
+    if ((pte = pc_pte(xm, frm_idx)) != NULL && pte->pt_dirty) {
+      dirty = 1;
+    }
+  }
+  if (!dirty) {
+    return OK;
+  }
+
+  if (write_bs((char *)((FRAME0 + frm_idx) * NBPG), (bsd_t)bs,
+               frm_tab[frm_idx].fr_bspage) == SYSERR) {
+    kprintf("pc_writeback: write failed for store %d page %d\n",
+            bs, frm_tab[frm_idx].fr_bspage);
+    return SYSERR;
+  }
+  pg_paged_out(frm_tab[frm_idx].fr_pid, 1);
+  tr_event(TR_WB, frm_tab[frm_idx].fr_pid, frm_tab[frm_idx].fr_vpno, 1);
+
+  tlb_begin(&tb);
+  for (xm = bsm_tab[bs].bs_xmhead; xm != -1; xm = xmmap_tab[xm].xm_next) {
+    if ((pte = pc_pte(xm, frm_idx)) != NULL) {
+      pte->pt_dirty = 0;
+      tlb_add(&tb, xmmap_tab[xm].xm_pid,
+              (unsigned long)(xmmap_tab[xm].xm_vpno + frm_tab[frm_idx].fr_bspage) << 12);
+    }
+  }
+  tlb_flush(&tb);
+  frm_tab[frm_idx].fr_dirty = 0;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * pc_unmap - remove cached frame frm_idx from every mapper's page table
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pc_unmap(int frm_idx)
+{
+  int bs, xm, pid, vpno;
+  pt_t *pte;
+  tlbbatch_t tb;
+
+  bs = frm_tab[frm_idx].fr_bs;
+  tlb_begin(&tb);
+  for (xm = bsm_tab[bs].bs_xmhead; xm != -1; xm = xmmap_tab[xm].xm_next) {
+    if ((pte = pc_pte(xm, frm_idx)) == NULL) {
+      continue;
+    }
+    pid = xmmap_tab[xm].xm_pid;
+    vpno = xmmap_tab[xm].xm_vpno + frm_tab[frm_idx].fr_bspage;
+    pte->pt_pres = 0;
+    tlb_add(&tb, pid, (unsigned long)vpno << 12);
+
+    pt_unref((pd_t *)proctab[pid].pdbr, (vpno >> 10) & 0x3FF);
+  }
+  tlb_flush(&tb);
+  frm_tab[frm_idx].fr_refcnt = 0;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * pc_drop - pid has just cleared its PTE for cached frame frm_idx; dirty
+ * says whether that PTE was dirty.  The last mapper out writes the page
+ * back and frees the frame.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pc_drop(int frm_idx, int pid, int dirty)
+{
+  int xm;
+
+  if (dirty) {
+    frm_tab[frm_idx].fr_dirty = 1;
+  }
+  if (--frm_tab[frm_idx].fr_refcnt <= 0) {
+    if (frm_tab[frm_idx].fr_dirty) {
+      if (write_bs((char *)((FRAME0 + frm_idx) * NBPG),
+                   (bsd_t)frm_tab[frm_idx].fr_bs,
+                   frm_tab[frm_idx].fr_bspage) == SYSERR) {
+        kprintf("pc_drop: write failed for store %d page %d\n",
+                frm_tab[frm_idx].fr_bs, frm_tab[frm_idx].fr_bspage);
+      } else {
+        pg_paged_out(pid, 1);
+        tr_event(TR_WB, pid, frm_tab[frm_idx].fr_vpno, 1);
+      }
+    }
+    return free_frm(frm_idx);
+  }
+  if (frm_tab[frm_idx].fr_pid != pid) {
+    return OK;
+  }
+
+  // The policies and the RSS charge follow a mapper that is still here
+  for (xm = bsm_tab[frm_tab[frm_idx].fr_bs].bs_xmhead; xm != -1;
+       xm = xmmap_tab[xm].xm_next) {
+    if (pc_pte(xm, frm_idx) != NULL) {
+      frm_tab[frm_idx].fr_pid = xmmap_tab[xm].xm_pid;
+      frm_tab[frm_idx].fr_vpno = xmmap_tab[xm].xm_vpno + frm_tab[frm_idx].fr_bspage;
+      rss_uncharge(frm_idx);
+      rss_charge(frm_idx);
+      return OK;
+    }
+  }
+  return SYSERR;
+}
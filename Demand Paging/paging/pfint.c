@@ -7,6 +7,221 @@
 
 extern unsigned long read_cr2(void);  /* Get faulted virtual address from CR2 */
 
+/* Pages mapped by readahead rather than by a fault of their own */
+unsigned long pf_nreadahead = 0;
+
+/*-------------------------------------------------------------------------
+ * pf_mapin - map page pageth of store at vpno through page table pt;
+ * pd_base is the frame number of pt
+ *
+ * An xmmap store page some other mapper already brought in is mapped
+ * from the page cache; anything else is read into a new frame.
+ *-------------------------------------------------------------------------
+ */
+static SYSCALL pf_mapin(pt_t *pt, unsigned int pd_base, int vpno, int store, int pageth)
+{
+  int frm_idx, pt_frm_idx;
+  unsigned int pt_idx = (unsigned int)vpno & 0x3FF;
+  int is_xmmap = (bsm_tab[store].bs_type == BS_TYPE_XMMAP);
+
+  if (is_xmmap && (frm_idx = pc_lookup(store, pageth)) != -1) {
+    frm_tab[frm_idx].fr_refcnt++;
+    pc_nhit++;
+  } else {
+    rss_trim();
+    if (get_frm_vp(&frm_idx, vpno) == SYSERR) {
+      return SYSERR;
+    }
+    if (read_bs((char *)((FRAME0 + frm_idx) * NBPG), (bsd_t)store, pageth) == SYSERR) {
+      free_frm(frm_idx);
+      return SYSERR;
+    }
+    proctab[currpid].ppgin += NBPG;
+
+    frm_tab[frm_idx].fr_status = FRM_MAPPED;
+    frm_tab[frm_idx].fr_pid = currpid;
+    frm_tab[frm_idx].fr_vpno = vpno;
+    frm_tab[frm_idx].fr_refcnt = 1;
+    frm_tab[frm_idx].fr_type = FR_PAGE;
+    frm_tab[frm_idx].fr_dirty = 0;
+    if (is_xmmap) {
+      pc_insert(frm_idx, store, pageth);
+    }
+
+    // Hand the frame to the replacement policy (only for page frames)
+    pr_insert(frm_idx);
+  }
+
+  // Update page table entry
+  pt[pt_idx].pt_pres = 1;
+  pt[pt_idx].pt_write = 1;
+  pt[pt_idx].pt_user = 0;
+  pt[pt_idx].pt_pwt = 0;
+  pt[pt_idx].pt_pcd = 0;
+  pt[pt_idx].pt_acc = 0;
+  pt[pt_idx].pt_dirty = 0;
+  pt[pt_idx].pt_mbz = 0;
+  pt[pt_idx].pt_global = 0;
+  pt[pt_idx].pt_avail = 0;
+  pt[pt_idx].pt_base = (unsigned int)(FRAME0 + frm_idx);
+
+  // Increment reference count of the page table frame
+  pt_frm_idx = (int)pd_base - FRAME0;
+  if (pt_frm_idx >= 0 && pt_frm_idx < NFRAMES) {
+    frm_tab[pt_frm_idx].fr_refcnt++;
+  }
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * pf_table - return the page table for pd[pd_idx], ready to be changed,
+ * or NULL if there is no frame for it
+ *
+ * A missing table is the one emptied here earlier, hooked back in, or a
+ * new one; a table shared after vfork() is copied first.
+ *-------------------------------------------------------------------------
+ */
+pt_t *pf_table(pd_t *pd, int pd_idx)
+{
+  int frm_index;
+  pt_t *pt;
+
+  if (pd[pd_idx].pd_pres || pt_reuse(currpid, pd, pd_idx) != NULL) {
+    return pt_unshare(pd, pd_idx);
+  }
+  if (get_frm(&frm_index) == SYSERR) {
+    return NULL;
+  }
+  pt = (pt_t *)((FRAME0 + frm_index) * NBPG);
+
+  // Initialize the page table entries as not present, writable
+  pg_fill(pt, PT_EMPTY);
+
+  // Update page directory entry to point to this new page table
+  pd[pd_idx].pd_pres = 1;
+  pd[pd_idx].pd_write = 1;
+  pd[pd_idx].pd_user = 0;
+  pd[pd_idx].pd_pwt = 0;
+  pd[pd_idx].pd_pcd = 0;
+  pd[pd_idx].pd_acc = 0;
+  pd[pd_idx].pd_mbz = 0;
+  pd[pd_idx].pd_fmb = 0;
+  pd[pd_idx].pd_global = 0;
+  pd[pd_idx].pd_avail = 0;
+  pd[pd_idx].pd_base = (unsigned int)(FRAME0 + frm_index);
+
+  // Update inverted page table entry for the page table
+  frm_tab[frm_index].fr_status = FRM_MAPPED;
+  frm_tab[frm_index].fr_pid = currpid;
+  frm_tab[frm_index].fr_vpno = pd_idx << 10;
+  frm_tab[frm_index].fr_refcnt = 0; 
+  frm_tab[frm_index].fr_type = FR_TBL;
+  frm_tab[frm_index].fr_dirty = 0;
+  frm_tab[frm_index].fr_nshare = 1;
+  return pt;
+}
+
+/*-------------------------------------------------------------------------
+ * pf_fetch - make page vpno of currpid's region vr present, evicting
+ * others if need be, and return its PTE in a private table, or NULL
+ *-------------------------------------------------------------------------
+ */
+pt_t *pf_fetch(vregion_t *vr, int vpno)
+{
+  pd_t *pd = (pd_t *)proctab[currpid].pdbr;
+  int pd_idx = (vpno >> 10) & 0x3FF;
+  pt_t *pt;
+
+  if ((pt = pf_table(pd, pd_idx)) == NULL) {
+    return NULL;
+  }
+  if (!pt[vpno & 0x3FF].pt_pres) {
+    if (pf_mapin(pt, pd[pd_idx].pd_base, vpno, vr->vr_bs_id,
+                 vpno - vr->vr_vpno) == SYSERR) {
+      return NULL;
+    }
+    // Making room may have emptied this page table and unhooked it
+    pd[pd_idx].pd_pres = 1;
+  }
+  return &pt[vpno & 0x3FF];
+}
+
+/*-------------------------------------------------------------------------
+ * pf_prefetch - map page vpno of region vr now if free frames allow,
+ * without waiting for a fault; SYSERR once memory is too tight
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pf_prefetch(vregion_t *vr, int vpno)
+{
+  pd_t *pd = (pd_t *)proctab[currpid].pdbr;
+  int pd_idx = (vpno >> 10) & 0x3FF;
+
+  if (pd[pd_idx].pd_pres &&
+      ((pt_t *)(pd[pd_idx].pd_base << 12))[vpno & 0x3FF].pt_pres) {
+    return OK;
+  }
+  if (frm_nfree <= frm_reserve || rss_full(currpid) ||
+      pf_fetch(vr, vpno) == NULL) {
+    return SYSERR;
+  }
+  pf_nreadahead++;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * pf_readahead - after a fault at vpno in region vr, map the following
+ * pages of the region too if the faults look like a sequential stream
+ *
+ * As in Linux readahead, a fault where the previous window ended means
+ * the stream continues and the window doubles up to RA_MAX; any other
+ * fault collapses it.  Only frames already on the free pool are used, and
+ * the window stops at the end of the region and of the page table.
+ *
+ * A region advised XM_RANDOM is never read ahead.  One advised
+ * XM_SEQUENTIAL always gets the full window, and the pages the stream
+ * has passed lose their reference bits so they are the first victims.
+ *-------------------------------------------------------------------------
+ */
+static void pf_readahead(vregion_t *vr, pt_t *pt, unsigned int pd_base, int vpno)
+{
+  int n, v, last;
+  tlbbatch_t tb;
+
+  if (vr->vr_advice == XM_RANDOM) {
+    return;
+  }
+  if (vr->vr_advice == XM_SEQUENTIAL) {
+    vr->vr_ra_win = RA_MAX;
+    tlb_begin(&tb);
+    for (v = max(vpno - RA_MAX, max(vr->vr_vpno, vpno & ~0x3FF)); v < vpno; v++) {
+      if (pt[v & 0x3FF].pt_pres && pt[v & 0x3FF].pt_acc) {
+        pt[v & 0x3FF].pt_acc = 0;
+        tlb_add(&tb, currpid, (unsigned long)v << 12);
+      }
+    }
+    tlb_flush(&tb);
+  } else if (vpno == vr->vr_ra_next) {
+    vr->vr_ra_win = vr->vr_ra_win ? min(2 * vr->vr_ra_win, RA_MAX) : RA_MIN;
+  } else {
+    vr->vr_ra_win = 0;
+  }
+
+  last = min(vpno + vr->vr_ra_win, vr->vr_vpno + vr->vr_npages - 1);
+  last = min(last, vpno | 0x3FF);
+  for (v = vpno + 1, n = 0; v <= last && frm_nfree > frm_reserve &&
+       !rss_full(currpid); v++) {
+    if (pt[v & 0x3FF].pt_pres) {
+      continue;
+    }
+    if (pf_mapin(pt, pd_base, v, vr->vr_bs_id, v - vr->vr_vpno) == SYSERR) {
+      break;
+    }
+    n++;
+  }
+  pf_nreadahead += n;
+  vr->vr_ra_next = v;
+}
+
 /*-------------------------------------------------------------------------
  * pfint - paging fault ISR
  *-------------------------------------------------------------------------
@@ -21,11 +236,8 @@ SYSCALL pfint()
   pd_t *pd;                        // Pointer to page directory 
   pt_t *pt;                        // Pointer to page table 
   int store, pageth;               // Backing store lookup results
-  int frm_index;                   // Allocated frame index (frm_tab index)
-  int page_frm_index;              // Frame index for the faulted page
-  unsigned long pt_phys_addr;
-  unsigned long page_phys_addr;
-  int is_xmmap = 0;                // Whether this is an xmmap page
+  int major;                       // Fault had to read the store
+  vregion_t *vr;                   // Region containing the faulted page
   
   // Get the faulted virtual address from CR2 register 
   fault_addr = read_cr2();
@@ -44,11 +256,26 @@ SYSCALL pfint()
   // Get pointer to current process's page directory 
   pd = (pd_t *) proctab[currpid].pdbr;
   
-  // Validate mapping exists in backing store
-  // Try xmmap first, then heap
-  if (xmmap_lookup(currpid, fault_addr, &store, &pageth) == OK) {
-    is_xmmap = 1;
-  } else if (bsm_lookup(currpid, fault_addr, &store, &pageth) == SYSERR) {
+  // Keep frames ready for stacks that grow on a double fault
+  stk_refill();
+  
+  // A paged stack grows on demand down to its create() size; below
+  // that is the guard page
+  if (stk_area(vpno)) {
+    if (stk_grow(currpid, (int)vpno, 0) == OK) {
+      proctab[currpid].pminflt++;
+      return OK;
+    }
+    stk_noverflow++;
+    kprintf("Stack overflow by pid %d at 0x%08x - killing process\n", currpid, fault_addr);
+    kill(currpid);
+    return SYSERR;
+  }
+  
+  // Validate mapping exists in backing store; one lookup in the
+  // per-process region index covers both xmmap and heap regions
+  vr = vr_lookup(currpid, (int)vpno);
+  if (vr == NULL) {
     int killed_pid = currpid;
     kprintf("Illegal access by pid %d at 0x%08x - killing process\n", killed_pid, fault_addr);
     kill(killed_pid);
@@ -57,131 +284,61 @@ SYSCALL pfint()
     // Just return SYSERR - the killed process should never execute again
     return SYSERR;
   }
+  store = vr->vr_bs_id;
+  pageth = (int)vpno - vr->vr_vpno;
   
 
-  // Ensure page table exists; if not, allocate and initialize
-  if (!pd[pd_idx].pd_pres) {
-    if (get_frm(&frm_index) == SYSERR) {
-      kprintf("No free frame for page table; pid %d fault at 0x%08x\n", currpid, fault_addr);
-      kill(currpid);
-      return SYSERR;
-    }
-
-    pt_phys_addr = (FRAME0 + frm_index) * NBPG;
-    pt = (pt_t *)pt_phys_addr;
-
-    // Initialize the page table entries as not present, writable
-    {
-      for (int i = 0; i < 1024; i++) {
-        pt[i].pt_pres = 0;
-        pt[i].pt_write = 1;
-        pt[i].pt_user = 0;
-        pt[i].pt_pwt = 0;
-        pt[i].pt_pcd = 0;
-        pt[i].pt_acc = 0;
-        pt[i].pt_dirty = 0;
-        pt[i].pt_mbz = 0;
-        pt[i].pt_global = 0;
-        pt[i].pt_avail = 0;
-        pt[i].pt_base = 0;
-      }
-    }
-
-    // Update page directory entry to point to this new page table
-    pd[pd_idx].pd_pres = 1;
-    pd[pd_idx].pd_write = 1;
-    pd[pd_idx].pd_user = 0;
-    pd[pd_idx].pd_pwt = 0;
-    pd[pd_idx].pd_pcd = 0;
-    pd[pd_idx].pd_acc = 0;
-    pd[pd_idx].pd_mbz = 0;
-    pd[pd_idx].pd_fmb = 0;
-    pd[pd_idx].pd_global = 0;
-    pd[pd_idx].pd_avail = 0;
-    pd[pd_idx].pd_base = (unsigned int)(FRAME0 + frm_index);
-
-    // Update inverted page table entry for the page table
-    frm_tab[frm_index].fr_status = FRM_MAPPED;
-    frm_tab[frm_index].fr_pid = currpid;
-    frm_tab[frm_index].fr_vpno = 0;
-    frm_tab[frm_index].fr_refcnt = 0; 
-    frm_tab[frm_index].fr_type = FR_TBL;
-    frm_tab[frm_index].fr_dirty = 0;
-  } else {
-    // Page table exists; get its address
-    pt_phys_addr = (pd[pd_idx].pd_base << 12);
-    pt = (pt_t *)pt_phys_addr;
+  // Ensure a private page table exists for the faulted page
+  if ((pt = pf_table(pd, pd_idx)) == NULL) {
+    kprintf("No free frame for page table; pid %d fault at 0x%08x\n", currpid, fault_addr);
+    kill(currpid);
+    return SYSERR;
   }
   
-  // For shared xmmap pages, if page is present but not dirty, we need to check
-  // if other processes have written to it and reload if necessary
-  if (is_xmmap && pt[pt_idx].pt_pres && !pt[pt_idx].pt_dirty) {
-    extern SYSCALL sync_bs_page(int, int, int);
-    // This will write back other processes' dirty pages and invalidate our page
-    // if other processes have written
-    sync_bs_page(store, pageth, (int)vpno);
-    
-    // After sync_bs_page, check if our page was invalidated
-    // If it was, we need to reload it below
+  // A present page can only fault on a write to a read-only mapping,
+  // which is legal only for copy-on-write heap pages
+  if ((pferrcode & PF_PROT) && pt[pt_idx].pt_pres) {
+    if ((pferrcode & PF_WRITE) && (pt[pt_idx].pt_avail & PT_COW) &&
+        cow_fault(&pt[pt_idx], (int)vpno) == OK) {
+      proctab[currpid].pminflt++;
+      tr_event(TR_FAULT, currpid, (int)vpno, 0);
+      return OK;
+    }
+    kprintf("Write to read-only page by pid %d at 0x%08x - killing process\n",
+            currpid, fault_addr);
+    kill(currpid);
+    return SYSERR;
   }
   
-  // If page not present, bring it in from backing store
+  // If page not present, bring it in from backing store or, for a page
+  // another xmmap mapper already has, from the page cache
   if (!pt[pt_idx].pt_pres) {
-    // For shared xmmap pages, write back any dirty pages from other processes
-    // before reading, to ensure we get the latest data
-    // (sync_bs_page may have already been called above if page was present)
-    if (is_xmmap) {
-      extern SYSCALL sync_bs_page(int, int, int);
-      sync_bs_page(store, pageth, (int)vpno);
-    }
-    
-    if (get_frm(&page_frm_index) == SYSERR) {
-      kprintf("No free frame for page-in; pid %d fault at 0x%08x\n", currpid, fault_addr);
-      kill(currpid);
-      return SYSERR;
-    }
-
-    page_phys_addr = (FRAME0 + page_frm_index) * NBPG;
-    if (read_bs((char *)page_phys_addr, (bsd_t)store, pageth) == SYSERR) {
-      kprintf("read_bs failed: store %d page %d for pid %d\n", store, pageth, currpid);
+    if (pf_mapin(pt, pd[pd_idx].pd_base, (int)vpno, store, pageth) == SYSERR) {
+      kprintf("Page-in failed: store %d page %d for pid %d fault at 0x%08x\n",
+              store, pageth, currpid, fault_addr);
       kill(currpid);
       return SYSERR;
     }
-
-    // Update page table entry
-    pt[pt_idx].pt_pres = 1;
-    pt[pt_idx].pt_write = 1;
-    pt[pt_idx].pt_user = 0;
-    pt[pt_idx].pt_pwt = 0;
-    pt[pt_idx].pt_pcd = 0;
-    pt[pt_idx].pt_acc = 0;
-    pt[pt_idx].pt_dirty = 0;
-    pt[pt_idx].pt_mbz = 0;
-    pt[pt_idx].pt_global = 0;
-    pt[pt_idx].pt_avail = 0;
-    pt[pt_idx].pt_base = (unsigned int)(FRAME0 + page_frm_index);
-
-    // Update frame table for the loaded page
-    frm_tab[page_frm_index].fr_status = FRM_MAPPED;
-    frm_tab[page_frm_index].fr_pid = currpid;
-    frm_tab[page_frm_index].fr_vpno = (int)vpno;
-    frm_tab[page_frm_index].fr_refcnt = 1;
-    frm_tab[page_frm_index].fr_type = FR_PAGE;
-    frm_tab[page_frm_index].fr_dirty = 0;
-
-    // Add frame to Second-Chance queue (only for page frames)
-    {
-      extern void add_to_sc_queue(int frm_idx);
-      add_to_sc_queue(page_frm_index);
+    // Making room may have emptied this page table and unhooked it
+    pd[pd_idx].pd_pres = 1;
+    pr_nfaults++;
+    // Only a frame just read in has a single mapper; a page cache hit
+    // made it at least two
+    major = frm_tab[(int)pt[pt_idx].pt_base - FRAME0].fr_refcnt == 1;
+    if (major) {
+      proctab[currpid].pmajflt++;
+    } else {
+      proctab[currpid].pminflt++;
     }
+    tr_event(TR_FAULT, currpid, (int)vpno, major);
 
-    // Increment reference count of the page table frame
-    {
-      int pt_frm_index = (int)pd[pd_idx].pd_base - FRAME0;
-      if (pt_frm_index >= 0 && pt_frm_index < NFRAMES) {
-        frm_tab[pt_frm_index].fr_refcnt++;
-      }
-    }
+    pf_readahead(vr, pt, pd[pd_idx].pd_base, (int)vpno);
+  } else {
+    // Mapped by the time we got here (a stale translation); count it as
+    // a reference
+    pr_touch((int)pt[pt_idx].pt_base - FRAME0);
+    proctab[currpid].pminflt++;
+    tr_event(TR_FAULT, currpid, (int)vpno, 0);
   }
   return OK;
 }
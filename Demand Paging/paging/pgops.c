@@ -0,0 +1,132 @@
+/* pgops.c - pg_init, pg_zero, pg_fill, pg_copy */
+
+#include <conf.h>
+#include <kernel.h>
+#include <paging.h>
+
+/* Whole pages are cleared and moved a word at a time with rep stosl and
+ * rep movsl, which the i586 pairs into one store per clock.  With MMX
+ * the kernels move 64 bytes per iteration through eight mm registers
+ * instead.  The mm registers are the x87 registers, and the kernels run
+ * in whatever process faulted, which may have floating point state live
+ * (printf's %f does).  The context switch does not save that state, so
+ * the MMX loops run with interrupts off, between an fnsave and an frstor
+ * of the process's FPU state; the 108 bytes cost far less than the page.
+ */
+#define PG_FPUSAVE	108		/* bytes fnsave stores		*/
+
+int pg_mmx = 0;				/* use the MMX kernels		*/
+
+/*-------------------------------------------------------------------------
+ * pg_init - pick the page kernels this CPU can run
+ *-------------------------------------------------------------------------
+ */
+void pg_init(void)
+{
+  // MMX instructions trap if CR0.EM or CR0.TS is set
+  pg_mmx = (cpu_features() & CPUID_MMX) && !(read_cr0() & (CR0_EM | CR0_TS));
+}
+
+/*-------------------------------------------------------------------------
+ * pg_zero - clear the NBPG bytes at dst, a page-aligned address
+ *-------------------------------------------------------------------------
+ */
+void pg_zero(void *dst)
+{
+  pg_fill(dst, 0);
+}
+
+/*-------------------------------------------------------------------------
+ * pg_fill - fill the page at dst with the 32-bit word val
+ *-------------------------------------------------------------------------
+ */
+void pg_fill(void *dst, unsigned long val)
+{
+  STATWORD ps;
+  unsigned char fs[PG_FPUSAVE];
+  unsigned long v[2];
+  int d0, d1;
+
+  if (!pg_mmx) {
+    __asm__ __volatile__ ("cld; rep stosl"
+                          : "=&c"(d0), "=&D"(d1)
+                          : "a"(val), "0"(NBPG / 4), "1"(dst)
+                          : "memory");
+    return;
+  }
+
+  v[0] = v[1] = val;
+  disable(ps);
+  __asm__ __volatile__ ("fnsave %0" : "=m"(fs));
+  __asm__ __volatile__ ("movq (%2), %%mm0\n"
+                        "1:\n\t"
+                        "movq %%mm0, (%0)\n\t"
+                        "movq %%mm0, 8(%0)\n\t"
+                        "movq %%mm0, 16(%0)\n\t"
+                        "movq %%mm0, 24(%0)\n\t"
+                        "movq %%mm0, 32(%0)\n\t"
+                        "movq %%mm0, 40(%0)\n\t"
+                        "movq %%mm0, 48(%0)\n\t"
+                        "movq %%mm0, 56(%0)\n\t"
+                        "addl $64, %0\n\t"
+                        "decl %1\n\t"
+                        "jnz 1b\n\t"
+                        "emms"
+                        : "=&r"(d0), "=&r"(d1)
+                        : "r"(v), "0"(dst), "1"(NBPG / 64)
+                        : "memory");
+  __asm__ __volatile__ ("frstor %0" : : "m"(fs));
+  restore(ps);
+}
+
+/*-------------------------------------------------------------------------
+ * pg_copy - copy n whole pages from src to dst
+ *-------------------------------------------------------------------------
+ */
+void pg_copy(void *dst, void *src, int n)
+{
+  STATWORD ps;
+  unsigned char fs[PG_FPUSAVE];
+  int d0, d1, d2;
+
+  if (n <= 0) {
+    return;
+  }
+  if (!pg_mmx) {
+    __asm__ __volatile__ ("cld; rep movsl"
+                          : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+                          : "0"(n * (NBPG / 4)), "1"(dst), "2"(src)
+                          : "memory");
+    return;
+  }
+
+  disable(ps);
+  __asm__ __volatile__ ("fnsave %0" : "=m"(fs));
+  __asm__ __volatile__ ("1:\n\t"
+                        "movq (%1), %%mm0\n\t"
+                        "movq 8(%1), %%mm1\n\t"
+                        "movq 16(%1), %%mm2\n\t"
+                        "movq 24(%1), %%mm3\n\t"
+                        "movq 32(%1), %%mm4\n\t"
+                        "movq 40(%1), %%mm5\n\t"
+                        "movq 48(%1), %%mm6\n\t"
+                        "movq 56(%1), %%mm7\n\t"
+                        "movq %%mm0, (%0)\n\t"
+                        "movq %%mm1, 8(%0)\n\t"
+                        "movq %%mm2, 16(%0)\n\t"
+                        "movq %%mm3, 24(%0)\n\t"
+                        "movq %%mm4, 32(%0)\n\t"
+                        "movq %%mm5, 40(%0)\n\t"
+                        "movq %%mm6, 48(%0)\n\t"
+                        "movq %%mm7, 56(%0)\n\t"
+                        "addl $64, %1\n\t"
+                        "addl $64, %0\n\t"
+                        "decl %2\n\t"
+                        "jnz 1b\n\t"
+                        "emms"
+                        : "=&r"(d0), "=&r"(d1), "=&r"(d2)
+                        : "0"(dst), "1"(src), "2"(n * (NBPG / 64))
+                        : "memory");
+  __asm__ __volatile__ ("frstor %0" : : "m"(fs));
+  restore(ps);
+}
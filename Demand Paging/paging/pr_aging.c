@@ -0,0 +1,120 @@
+/* pr_aging.c - AGING page replacement policy */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* 8-bit age per frame: shifted right on every PR_TICK_MS tick with the
+ * hardware reference bit ORed into the top, so recently used pages have
+ * large ages and the victim is the resident page with the smallest one.
+ */
+static unsigned char ag_age[NFRAMES];
+static char ag_in[NFRAMES];		/* frame is tracked by AGING	*/
+static int ag_hand = 0;			/* where the next scan starts	*/
+
+/*-------------------------------------------------------------------------
+ * ag_init - forget every frame
+ *-------------------------------------------------------------------------
+ */
+static void ag_init(void)
+{
+  int i;
+  for (i = 0; i < NFRAMES; i++) {
+    ag_age[i] = 0;
+    ag_in[i] = 0;
+  }
+  ag_hand = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * ag_insert - a page was just brought in, so treat it as just referenced
+ *-------------------------------------------------------------------------
+ */
+static void ag_insert(int frm_idx)
+{
+  ag_in[frm_idx] = 1;
+  ag_age[frm_idx] = 0x80;
+}
+
+/*-------------------------------------------------------------------------
+ * ag_touch - note an explicit reference
+ *-------------------------------------------------------------------------
+ */
+static void ag_touch(int frm_idx)
+{
+  ag_age[frm_idx] |= 0x80;
+}
+
+/*-------------------------------------------------------------------------
+ * ag_remove - stop tracking a frame
+ *-------------------------------------------------------------------------
+ */
+static void ag_remove(int frm_idx)
+{
+  ag_in[frm_idx] = 0;
+  ag_age[frm_idx] = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * ag_tick - decay every age and fold in the reference bits
+ *-------------------------------------------------------------------------
+ */
+static void ag_tick(void)
+{
+  int i;
+  pt_t *pte;
+  tlbbatch_t tb;
+
+  // A cached translation never sets the bit again, so the running
+  // process's cleared pages are flushed once the tick is done
+  tlb_begin(&tb);
+  for (i = 0; i < NFRAMES; i++) {
+    if (!ag_in[i]) {
+      continue;
+    }
+    ag_age[i] >>= 1;
+    if ((pte = frm_pte(i)) != NULL && pte->pt_acc) {
+      ag_age[i] |= 0x80;
+      pte->pt_acc = 0;
+      tlb_add(&tb, frm_tab[i].fr_pid, (unsigned long)frm_tab[i].fr_vpno << 12);
+    }
+  }
+  tlb_flush(&tb);
+}
+
+/*-------------------------------------------------------------------------
+ * ag_evict - pick the resident page with the smallest age
+ *
+ * Scanning starts after the previous victim so that equal ages are taken
+ * round-robin instead of always from the low frames.
+ *-------------------------------------------------------------------------
+ */
+static int ag_evict(void)
+{
+  int i, n;
+  int victim = SYSERR;
+  unsigned int best = 0x100;
+
+  for (n = 0; n < NFRAMES; n++) {
+    i = (ag_hand + n) % NFRAMES;
+    if (!ag_in[i] || frm_pte(i) == NULL) {
+      continue;
+    }
+    if (ag_age[i] < best) {
+      best = ag_age[i];
+      victim = i;
+      if (best == 0) {
+        break;
+      }
+    }
+  }
+  if (victim != SYSERR) {
+    ag_hand = (victim + 1) % NFRAMES;
+  }
+  return victim;
+}
+
+pr_policy_t pr_aging_policy = {
+  "AGING", ag_init, ag_insert, ag_touch, ag_evict, ag_remove, ag_tick
+};
@@ -0,0 +1,317 @@
+/* pr_car.c - CAR (Clock with Adaptive Replacement) page replacement policy */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* CAR keeps two clocks of resident pages: T1 holds pages seen once
+ * recently, T2 pages seen at least twice.  Two history lists B1/B2
+ * remember (pid, vpno) of pages recently evicted from T1/T2; a refault
+ * that hits B1 grows the target size p of T1, one that hits B2 shrinks
+ * it, so the split between recency and frequency adapts to the workload.
+ */
+
+#define CAR_NONE	0
+#define CAR_T1		1
+#define CAR_T2		2
+#define CAR_B1		1
+#define CAR_B2		2
+
+#define CAR_NGHOST	NFRAMES
+#define CAR_NHASH	256
+#define car_hash(pid, vpno)	((((pid) * 31) + (vpno)) & (CAR_NHASH - 1))
+
+/* Resident clocks: circular doubly linked lists whose head is the hand */
+static int car_where[NFRAMES];		/* CAR_NONE, CAR_T1 or CAR_T2	*/
+static char car_fresh[NFRAMES];		/* not referenced since insert	*/
+static int car_next[NFRAMES];
+static int car_prev[NFRAMES];
+static int t_head[3];
+static int t_n[3];
+
+/* History (ghost) lists: circular doubly linked, head is the LRU end */
+typedef struct {
+  int g_pid;
+  int g_vpno;
+  int g_list;				/* CAR_B1, CAR_B2 or 0 if free	*/
+  int g_hnext;				/* hash chain or free list	*/
+} car_ghost_t;
+
+static car_ghost_t ghost[CAR_NGHOST];
+static int g_nextv[CAR_NGHOST];		/* LRU order within B1/B2	*/
+static int g_prevv[CAR_NGHOST];
+static int g_hash[CAR_NHASH];
+static int b_head[3];
+static int b_n[3];
+static int g_free;
+
+static int car_p;			/* target size of T1		*/
+static int car_c;			/* cache size seen when full	*/
+
+/*-------------------------------------------------------------------------
+ * ring_add - append x at the tail of the circular list rooted at *head
+ *-------------------------------------------------------------------------
+ */
+static void ring_add(int *head, int *next, int *prev, int x)
+{
+  if (*head == -1) {
+    *head = x;
+    next[x] = prev[x] = x;
+  } else {
+    int tail = prev[*head];
+    next[tail] = x;
+    prev[x] = tail;
+    next[x] = *head;
+    prev[*head] = x;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * ring_del - unlink x from the circular list rooted at *head
+ *-------------------------------------------------------------------------
+ */
+static void ring_del(int *head, int *next, int *prev, int x)
+{
+  if (next[x] == x) {
+    *head = -1;
+  } else {
+    next[prev[x]] = next[x];
+    prev[next[x]] = prev[x];
+    if (*head == x) {
+      *head = next[x];
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * ghost_find - return the history entry for (pid, vpno), or -1
+ *-------------------------------------------------------------------------
+ */
+static int ghost_find(int pid, int vpno)
+{
+  int g;
+  for (g = g_hash[car_hash(pid, vpno)]; g != -1; g = ghost[g].g_hnext) {
+    if (ghost[g].g_pid == pid && ghost[g].g_vpno == vpno) {
+      return g;
+    }
+  }
+  return -1;
+}
+
+/*-------------------------------------------------------------------------
+ * ghost_drop - forget history entry g
+ *-------------------------------------------------------------------------
+ */
+static void ghost_drop(int g)
+{
+  int *link;
+  int list = ghost[g].g_list;
+
+  ring_del(&b_head[list], g_nextv, g_prevv, g);
+  b_n[list]--;
+  for (link = &g_hash[car_hash(ghost[g].g_pid, ghost[g].g_vpno)];
+       *link != -1; link = &ghost[*link].g_hnext) {
+    if (*link == g) {
+      *link = ghost[g].g_hnext;
+      break;
+    }
+  }
+  ghost[g].g_list = 0;
+  ghost[g].g_hnext = g_free;
+  g_free = g;
+}
+
+/*-------------------------------------------------------------------------
+ * ghost_add - remember the page in frame frm_idx at the MRU end of list
+ *-------------------------------------------------------------------------
+ */
+static void ghost_add(int list, int frm_idx)
+{
+  int g, h;
+  int pid = frm_tab[frm_idx].fr_pid;
+  int vpno = frm_tab[frm_idx].fr_vpno;
+
+  if ((g = ghost_find(pid, vpno)) != -1) {
+    ghost_drop(g);
+  }
+  if (g_free == -1) {
+    /* Pool exhausted: sacrifice the oldest entry of the longer list */
+    ghost_drop(b_head[b_n[CAR_B1] >= b_n[CAR_B2] ? CAR_B1 : CAR_B2]);
+  }
+  g = g_free;
+  g_free = ghost[g].g_hnext;
+
+  ghost[g].g_pid = pid;
+  ghost[g].g_vpno = vpno;
+  ghost[g].g_list = list;
+  h = car_hash(pid, vpno);
+  ghost[g].g_hnext = g_hash[h];
+  g_hash[h] = g;
+  ring_add(&b_head[list], g_nextv, g_prevv, g);
+  b_n[list]++;
+}
+
+/*-------------------------------------------------------------------------
+ * car_init - empty all four lists
+ *-------------------------------------------------------------------------
+ */
+static void car_init(void)
+{
+  int i;
+
+  for (i = 0; i < NFRAMES; i++) {
+    car_where[i] = CAR_NONE;
+    car_fresh[i] = 0;
+  }
+  for (i = 0; i < CAR_NHASH; i++) {
+    g_hash[i] = -1;
+  }
+  for (i = 0; i < CAR_NGHOST; i++) {
+    ghost[i].g_list = 0;
+    ghost[i].g_hnext = (i + 1 < CAR_NGHOST) ? i + 1 : -1;
+  }
+  g_free = 0;
+  for (i = 0; i < 3; i++) {
+    t_head[i] = b_head[i] = -1;
+    t_n[i] = b_n[i] = 0;
+  }
+  car_p = 0;
+  car_c = NFRAMES;
+}
+
+/*-------------------------------------------------------------------------
+ * car_insert - a page was brought in; consult the history lists
+ *-------------------------------------------------------------------------
+ */
+static void car_insert(int frm_idx)
+{
+  int g, list;
+
+  if (car_where[frm_idx] != CAR_NONE) {
+    return;
+  }
+
+  g = ghost_find(frm_tab[frm_idx].fr_pid, frm_tab[frm_idx].fr_vpno);
+  if (g == -1) {
+    /* Cold miss: keep the history bounded by the cache size */
+    if (t_n[CAR_T1] + b_n[CAR_B1] >= car_c && b_n[CAR_B1] > 0) {
+      ghost_drop(b_head[CAR_B1]);
+    } else if (t_n[CAR_T1] + t_n[CAR_T2] + b_n[CAR_B1] + b_n[CAR_B2] >= 2 * car_c &&
+               b_n[CAR_B2] > 0) {
+      ghost_drop(b_head[CAR_B2]);
+    }
+    list = CAR_T1;
+  } else if (ghost[g].g_list == CAR_B1) {
+    /* Evicted from T1 too early: favour recency */
+    car_p = min(car_p + max(1, b_n[CAR_B2] / b_n[CAR_B1]), car_c);
+    ghost_drop(g);
+    list = CAR_T2;
+  } else {
+    /* Evicted from T2 too early: favour frequency */
+    car_p = max(car_p - max(1, b_n[CAR_B1] / b_n[CAR_B2]), 0);
+    ghost_drop(g);
+    list = CAR_T2;
+  }
+
+  car_where[frm_idx] = list;
+  car_fresh[frm_idx] = 1;
+  ring_add(&t_head[list], car_next, car_prev, frm_idx);
+  t_n[list]++;
+}
+
+/*-------------------------------------------------------------------------
+ * car_touch - note an explicit reference
+ *-------------------------------------------------------------------------
+ */
+static void car_touch(int frm_idx)
+{
+  pt_t *pte;
+
+  car_fresh[frm_idx] = 0;
+  if ((pte = frm_pte(frm_idx)) != NULL) {
+    pte->pt_acc = 1;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * car_remove - take a frame off whichever clock holds it
+ *-------------------------------------------------------------------------
+ */
+static void car_remove(int frm_idx)
+{
+  int list = car_where[frm_idx];
+
+  if (list == CAR_NONE) {
+    return;
+  }
+  ring_del(&t_head[list], car_next, car_prev, frm_idx);
+  t_n[list]--;
+  car_where[frm_idx] = CAR_NONE;
+  car_fresh[frm_idx] = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * car_evict - sweep the clocks until an unreferenced page is found
+ *
+ * The victim stays on its clock until get_frm() calls car_remove(); its
+ * identity is recorded in B1 or B2 here.
+ *-------------------------------------------------------------------------
+ */
+static int car_evict(void)
+{
+  int f, n;
+  int limit;
+  pt_t *pte;
+  tlbbatch_t tb;
+
+  car_c = t_n[CAR_T1] + t_n[CAR_T2];
+  limit = 3 * car_c + 1;
+
+  // Cleared bits of the running process are flushed before returning,
+  // or its cached translations never set them again
+  tlb_begin(&tb);
+  for (n = 0; n < limit && car_c > 0; n++) {
+    if (t_n[CAR_T1] >= max(1, car_p) || t_n[CAR_T2] == 0) {
+      f = t_head[CAR_T1];
+      pte = frm_pte(f);
+      if (pte == NULL || !pte->pt_acc) {
+        tlb_flush(&tb);
+        ghost_add(CAR_B1, f);
+        return f;
+      }
+      pte->pt_acc = 0;
+      tlb_add(&tb, frm_tab[f].fr_pid, (unsigned long)frm_tab[f].fr_vpno << 12);
+      if (car_fresh[f]) {
+        /* Only the faulting access so far: one more lap in T1 */
+        car_fresh[f] = 0;
+        t_head[CAR_T1] = car_next[f];
+      } else {
+        /* Referenced again: promote to the tail of T2 */
+        ring_del(&t_head[CAR_T1], car_next, car_prev, f);
+        t_n[CAR_T1]--;
+        ring_add(&t_head[CAR_T2], car_next, car_prev, f);
+        t_n[CAR_T2]++;
+        car_where[f] = CAR_T2;
+      }
+    } else {
+      f = t_head[CAR_T2];
+      pte = frm_pte(f);
+      if (pte == NULL || !pte->pt_acc) {
+        tlb_flush(&tb);
+        ghost_add(CAR_B2, f);
+        return f;
+      }
+      pte->pt_acc = 0;
+      tlb_add(&tb, frm_tab[f].fr_pid, (unsigned long)frm_tab[f].fr_vpno << 12);
+      car_fresh[f] = 0;
+      t_head[CAR_T2] = car_next[f];
+    }
+  }
+  tlb_flush(&tb);
+  return SYSERR;
+}
+
+pr_policy_t pr_car_policy = {
+  "CAR", car_init, car_insert, car_touch, car_evict, car_remove, NULL
+};
@@ -0,0 +1,131 @@
+/* pr_policy.c - srpolicy, grpolicy, page replacement dispatch */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+extern int page_replace_policy;
+
+extern pr_policy_t pr_sc_policy;
+extern pr_policy_t pr_aging_policy;
+extern pr_policy_t pr_car_policy;
+extern pr_policy_t pr_wsclock_policy;
+
+/* Currently selected policy; every frame.c/pfint.c call goes through it */
+pr_policy_t *pr_curr = &pr_sc_policy;
+
+/* Counters for comparing policies on the same workload */
+unsigned long pr_nfaults = 0;		/* page-ins from backing store	*/
+unsigned long pr_nevicts = 0;		/* frames taken by replacement	*/
+unsigned long pr_nclass[PR_NCLASS];	/* victims by (referenced, dirty) */
+
+/* Clock ticks left until the next pr_clock(); decremented in clkint */
+int pr_ticks = PR_TICK_MS;
+
+/*-------------------------------------------------------------------------
+ * pr_lookup - map a policy constant to its operations table
+ *-------------------------------------------------------------------------
+ */
+static pr_policy_t *pr_lookup(int policy)
+{
+  switch (policy) {
+  case SC:	return &pr_sc_policy;
+  case AGING:	return &pr_aging_policy;
+  case CAR:	return &pr_car_policy;
+  case WSCLOCK:	return &pr_wsclock_policy;
+  }
+  return NULL;
+}
+
+/*-------------------------------------------------------------------------
+ * srpolicy - select the page replacement policy
+ *
+ * Meant to be called once at boot, but switching later is safe: the new
+ * policy starts from an empty state and is handed every resident page.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL srpolicy(int policy)
+{
+  STATWORD ps;
+  pr_policy_t *pp;
+  int i;
+
+  if ((pp = pr_lookup(policy)) == NULL) {
+    return SYSERR;
+  }
+
+  disable(ps);
+  pr_curr = pp;
+  page_replace_policy = policy;
+  pr_curr->pp_init();
+  for (i = 0; i < NFRAMES; i++) {
+    if (frm_tab[i].fr_status == FRM_MAPPED && frm_tab[i].fr_type == FR_PAGE &&
+        frm_tab[i].fr_pin == 0) {
+      pr_curr->pp_insert(i);
+    }
+  }
+  pr_nfaults = 0;
+  pr_nevicts = 0;
+  for (i = 0; i < PR_NCLASS; i++) {
+    pr_nclass[i] = 0;
+  }
+  restore(ps);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * grpolicy - return the current page replacement policy
+ *-------------------------------------------------------------------------
+ */
+SYSCALL grpolicy()
+{
+  return page_replace_policy;
+}
+
+/*-------------------------------------------------------------------------
+ * pr_clock - called from clkint every PR_TICK_MS ticks
+ *-------------------------------------------------------------------------
+ */
+void pr_clock(void)
+{
+  pr_ticks = PR_TICK_MS;
+  rss_tick();
+  if (pr_curr->pp_tick != NULL) {
+    pr_curr->pp_tick();
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * frm_pte - return the page table entry that maps page frame frm_idx,
+ * or NULL if the frame is not a resident page of a live address space
+ *-------------------------------------------------------------------------
+ */
+pt_t *frm_pte(int frm_idx)
+{
+  unsigned long vaddr;
+  pd_t *pd;
+  pt_t *pt;
+  int pid;
+
+  if (frm_tab[frm_idx].fr_status != FRM_MAPPED ||
+      frm_tab[frm_idx].fr_type != FR_PAGE) {
+    return NULL;
+  }
+  pid = frm_tab[frm_idx].fr_pid;
+  if (pid < 0 || pid >= NPROC || proctab[pid].pdbr == 0) {
+    return NULL;
+  }
+
+  vaddr = (unsigned long)frm_tab[frm_idx].fr_vpno << 12;
+  pd = (pd_t *)proctab[pid].pdbr;
+  if (!pd[(vaddr >> 22) & 0x3FF].pd_pres) {
+    return NULL;
+  }
+  pt = (pt_t *)(pd[(vaddr >> 22) & 0x3FF].pd_base << 12);
+  pt = &pt[(vaddr >> 12) & 0x3FF];
+  if (!pt->pt_pres) {
+    return NULL;
+  }
+  return pt;
+}
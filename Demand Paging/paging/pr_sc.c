@@ -0,0 +1,252 @@
+/* pr_sc.c - Second-Chance page replacement policy */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* Second-Chance page replacement queue */
+static int sc_next[NFRAMES];  /* next frame index in circular queue */
+static int sc_head = -1;      /* head of circular queue (-1 if empty) */
+static int sc_count = 0;      /* number of frames in queue */
+
+/*-------------------------------------------------------------------------
+ * sc_init - empty the Second-Chance queue
+ *-------------------------------------------------------------------------
+ */
+static void sc_init(void)
+{
+  int i;
+  for (i = 0; i < NFRAMES; i++) {
+    sc_next[i] = -1;
+  }
+  sc_head = -1;
+  sc_count = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * sc_insert - add a frame to the Second-Chance circular queue
+ *-------------------------------------------------------------------------
+ */
+static void sc_insert(int frm_idx)
+{
+  /* Check if frame is already in queue */
+  if (sc_next[frm_idx] != -1) {
+    return;  /* Already in queue */
+  }
+
+  if (sc_head == -1) {
+    /* Queue is empty, initialize */
+    sc_head = frm_idx;
+    sc_next[frm_idx] = frm_idx;  /* Point to itself (circular) */
+    sc_count = 1;
+  } else {
+    /* Add to end of queue (before head) */
+    int current = sc_head;
+    /* Find the last element (points to head) */
+    while (sc_next[current] != sc_head) {
+      current = sc_next[current];
+    }
+    /* Insert new frame after last element, before head */
+    sc_next[frm_idx] = sc_head;
+    sc_next[current] = frm_idx;
+    sc_count++;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * sc_remove - remove a frame from the Second-Chance queue
+ *-------------------------------------------------------------------------
+ */
+static void sc_remove(int frm_idx)
+{
+  if (sc_head == -1) {
+    return;  /* Queue is empty */
+  }
+
+  if (sc_next[frm_idx] == -1) {
+    return;  /* Frame not in queue */
+  }
+
+  if (sc_count == 1) {
+    /* Only one element */
+    sc_head = -1;
+    sc_next[frm_idx] = -1;
+    sc_count = 0;
+    return;
+  }
+
+  /* Find previous element */
+  int current = sc_head;
+  while (sc_next[current] != frm_idx) {
+    current = sc_next[current];
+    if (current == sc_head) {
+      /* Frame not found in queue */
+      return;
+    }
+  }
+
+  /* Remove from queue */
+  sc_next[current] = sc_next[frm_idx];
+  if (sc_head == frm_idx) {
+    sc_head = sc_next[frm_idx];
+  }
+  sc_next[frm_idx] = -1;
+  sc_count--;
+}
+
+/*-------------------------------------------------------------------------
+ * sc_evict - Second-Chance page replacement algorithm
+ *
+ * Returns the frame index to evict, or SYSERR if no frame can be evicted.
+ *-------------------------------------------------------------------------
+ */
+static int sc_evict(void)
+{
+  int candidate;
+  int start;
+  int pid, vpno;
+  unsigned long vaddr;
+  unsigned int pd_idx, pt_idx;
+  pd_t *pd;
+  pt_t *pt;
+
+  if (sc_head == -1) {
+    int i;
+    for (i = 5; i < NFRAMES; i++) {
+      // A locked page stays put however empty the queue is
+      if (frm_tab[i].fr_status == FRM_MAPPED && frm_tab[i].fr_type == FR_PAGE &&
+          frm_tab[i].fr_pin == 0) {
+        return i;
+      }
+    }
+    return SYSERR;
+  }
+
+  start = sc_head;
+  candidate = sc_head;
+
+  int first_pass = 1;
+  int iterations = 0;
+  int max_iterations = sc_count * 2 + 10;
+
+  do {
+    iterations++;
+    if (iterations > max_iterations) {
+      break;
+    }
+
+    pid = frm_tab[candidate].fr_pid;
+    vpno = frm_tab[candidate].fr_vpno;
+
+    if (pid == -1 || frm_tab[candidate].fr_status != FRM_MAPPED ||
+        frm_tab[candidate].fr_type != FR_PAGE) {
+      int next = sc_next[candidate];
+      if (next == -1 || next == candidate) {
+        break;
+      }
+      candidate = next;
+      if (candidate == start) {
+        if (!first_pass) {
+          break;
+        }
+        first_pass = 0;
+      }
+      continue;
+    }
+
+    vaddr = (unsigned long)vpno << 12;
+    pd_idx = (vaddr >> 22) & 0x3FF;
+    pt_idx = (vaddr >> 12) & 0x3FF;
+
+    pd = (pd_t *) proctab[pid].pdbr;
+    if (!pd || !pd[pd_idx].pd_pres) {
+      int next = sc_next[candidate];
+      if (next == -1 || next == candidate) {
+        break;
+      }
+      candidate = next;
+      if (candidate == start) {
+        if (!first_pass) {
+          break;
+        }
+        first_pass = 0;
+      }
+      continue;
+    }
+
+    pt = (pt_t *)(pd[pd_idx].pd_base << 12);
+    if (!pt || !pt[pt_idx].pt_pres) {
+      /* Skip if page table entry not present */
+      int next = sc_next[candidate];
+      if (next == -1 || next == candidate) {
+        break;
+      }
+      candidate = next;
+      if (candidate == start) {
+        if (!first_pass) {
+          break;
+        }
+        first_pass = 0;
+      }
+      continue;
+    }
+
+    if (!pt[pt_idx].pt_acc) {
+      int next = sc_next[candidate];
+      if (next != -1 && next != candidate) {
+        sc_head = next;
+      } else {
+        sc_head = -1;
+      }
+      return candidate;
+    }
+
+    /* Clear the reference bit */
+    pt[pt_idx].pt_acc = 0;
+
+    int next = sc_next[candidate];
+    if (next == -1 || next == candidate) {
+      break;
+    }
+    candidate = next;
+
+    sc_head = candidate;
+
+    if (candidate == start) {
+      if (!first_pass) {
+        break;
+      }
+      first_pass = 0;
+    }
+
+  } while (1);
+
+  if (candidate >= 0 && candidate < NFRAMES &&
+      frm_tab[candidate].fr_status == FRM_MAPPED &&
+      frm_tab[candidate].fr_type == FR_PAGE) {
+    return candidate;
+  }
+
+  int i;
+  for (i = 5; i < NFRAMES; i++) {
+    if (frm_tab[i].fr_status == FRM_MAPPED && frm_tab[i].fr_type == FR_PAGE &&
+        frm_tab[i].fr_pin == 0) {
+      return i;
+    }
+  }
+
+  return SYSERR;
+}
+
+/*-------------------------------------------------------------------------
+ * sc_touch - the hardware reference bit already records the access
+ *-------------------------------------------------------------------------
+ */
+static void sc_touch(int frm_idx)
+{
+}
+
+pr_policy_t pr_sc_policy = {
+  "SC", sc_init, sc_insert, sc_touch, sc_evict, sc_remove, NULL
+};
@@ -0,0 +1,203 @@
+/* pr_wsclock.c - WSCLOCK (clean-first, scan-resistant clock) policy */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* Resident pages sit on one of two clocks.  A page starts on the
+ * probation clock and moves to the protected clock only if it is found
+ * referenced on a later sweep than the one after its fault, so a page
+ * touched once by a sequential pass never gets there and the pass
+ * recycles its own frames.  The protected clock is kept to WS_PROT_PCT
+ * of the resident pages; its oldest pages drop back to probation.
+ *
+ * The hand looks for a victim in the (referenced, dirty) classes of
+ * NRU: an unreferenced clean page is taken at once, while unreferenced
+ * dirty pages are only remembered on the first lap and handed to the
+ * writeback daemon, as in WSClock.  Only a lap with no clean page falls
+ * back to the first dirty one.
+ */
+#define WS_PROB		0
+#define WS_PROT		1
+#define WS_NONE		2
+#define WS_PROT_PCT	75	/* most of the resident pages protected	*/
+
+static int ws_where[NFRAMES];		/* WS_PROB, WS_PROT or WS_NONE	*/
+static char ws_fresh[NFRAMES];		/* not referenced since insert	*/
+static int ws_next[NFRAMES];
+static int ws_prev[NFRAMES];
+static int ws_head[2];			/* clock hands			*/
+static int ws_n[2];
+
+/*-------------------------------------------------------------------------
+ * ws_add - put frame x behind the hand of clock list
+ *-------------------------------------------------------------------------
+ */
+static void ws_add(int list, int x)
+{
+  int h = ws_head[list];
+
+  if (h == -1) {
+    ws_head[list] = x;
+    ws_next[x] = ws_prev[x] = x;
+  } else {
+    ws_next[ws_prev[h]] = x;
+    ws_prev[x] = ws_prev[h];
+    ws_next[x] = h;
+    ws_prev[h] = x;
+  }
+  ws_where[x] = list;
+  ws_n[list]++;
+}
+
+/*-------------------------------------------------------------------------
+ * ws_del - take frame x off the clock it is on
+ *-------------------------------------------------------------------------
+ */
+static void ws_del(int x)
+{
+  int list = ws_where[x];
+
+  if (ws_next[x] == x) {
+    ws_head[list] = -1;
+  } else {
+    ws_next[ws_prev[x]] = ws_next[x];
+    ws_prev[ws_next[x]] = ws_prev[x];
+    if (ws_head[list] == x) {
+      ws_head[list] = ws_next[x];
+    }
+  }
+  ws_where[x] = WS_NONE;
+  ws_n[list]--;
+}
+
+/*-------------------------------------------------------------------------
+ * ws_init - empty both clocks
+ *-------------------------------------------------------------------------
+ */
+static void ws_init(void)
+{
+  int i;
+
+  for (i = 0; i < NFRAMES; i++) {
+    ws_where[i] = WS_NONE;
+    ws_fresh[i] = 0;
+  }
+  ws_head[WS_PROB] = ws_head[WS_PROT] = -1;
+  ws_n[WS_PROB] = ws_n[WS_PROT] = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * ws_insert - a page was brought in; it starts on probation
+ *-------------------------------------------------------------------------
+ */
+static void ws_insert(int frm_idx)
+{
+  if (ws_where[frm_idx] != WS_NONE) {
+    return;
+  }
+  ws_fresh[frm_idx] = 1;
+  ws_add(WS_PROB, frm_idx);
+}
+
+/*-------------------------------------------------------------------------
+ * ws_touch - note an explicit reference
+ *-------------------------------------------------------------------------
+ */
+static void ws_touch(int frm_idx)
+{
+  pt_t *pte;
+
+  ws_fresh[frm_idx] = 0;
+  if ((pte = frm_pte(frm_idx)) != NULL) {
+    pte->pt_acc = 1;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * ws_remove - a frame left memory
+ *-------------------------------------------------------------------------
+ */
+static void ws_remove(int frm_idx)
+{
+  if (ws_where[frm_idx] != WS_NONE) {
+    ws_del(frm_idx);
+  }
+  ws_fresh[frm_idx] = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * ws_sweep - run the hand of clock list for up to two laps and return a
+ * victim, or SYSERR if the clock is or became empty
+ *-------------------------------------------------------------------------
+ */
+static int ws_sweep(int list)
+{
+  int f, n, lap, dirty = SYSERR;
+  pt_t *pte;
+
+  lap = ws_n[list];
+  for (n = 0; n < 2 * lap && (f = ws_head[list]) != -1; n++) {
+    pte = frm_pte(f);
+    if (pte == NULL) {
+      return f;
+    }
+    if (pte->pt_acc) {
+      pte->pt_acc = 0;
+      // Otherwise the cached translation never sets the bit again
+      if (frm_tab[f].fr_pid == currpid) {
+        invltlb((unsigned long)frm_tab[f].fr_vpno << 12);
+      }
+      if (list == WS_PROB && !ws_fresh[f]) {
+        ws_del(f);
+        ws_add(WS_PROT, f);
+        continue;
+      }
+      ws_fresh[f] = 0;
+    } else if (!pte->pt_dirty && !frm_tab[f].fr_dirty) {
+      return f;
+    } else if (dirty == SYSERR) {
+      dirty = f;
+      wb_kick();
+    }
+    ws_head[list] = ws_next[f];
+
+    // A whole lap without a clean page: settle for the oldest dirty one
+    if (n + 1 >= lap && dirty != SYSERR) {
+      return dirty;
+    }
+  }
+  return dirty != SYSERR ? dirty : ws_head[list];
+}
+
+/*-------------------------------------------------------------------------
+ * ws_evict - choose a victim, from probation while it holds enough pages
+ *-------------------------------------------------------------------------
+ */
+static int ws_evict(void)
+{
+  int f, total = ws_n[WS_PROB] + ws_n[WS_PROT];
+
+  if (total == 0) {
+    return SYSERR;
+  }
+
+  // Keep the protected clock to its share; its oldest pages get another
+  // chance on probation, unreferenced
+  while (ws_n[WS_PROT] * 100 > total * WS_PROT_PCT) {
+    f = ws_head[WS_PROT];
+    ws_del(f);
+    ws_fresh[f] = 0;
+    ws_add(WS_PROB, f);
+  }
+
+  if ((f = ws_sweep(WS_PROB)) != SYSERR) {
+    return f;
+  }
+  return ws_sweep(WS_PROT);
+}
+
+pr_policy_t pr_wsclock_policy = {
+  "WSCLOCK", ws_init, ws_insert, ws_touch, ws_evict, ws_remove, NULL
+};
@@ -0,0 +1,69 @@
+/* pressure.c - pgnotify, pgpressure, pp_update */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* A process that calls pgnotify(level) is sent the message
+ * PP_MSGBASE | l by the writeback daemon when the pressure level l
+ * reaches level, and again each time it climbs higher.  Once pressure
+ * drops below level the next rise is reported afresh.  Messages use the
+ * ordinary one-word mailbox, so a process that has not read the last one
+ * misses the next rather than queueing them up.  The free pool crossing
+ * WB_HIWAT or WB_LOWAT wakes the daemon, so each level is seen.
+ */
+unsigned long pp_nsent = 0;		/* pressure messages delivered	*/
+
+/*-------------------------------------------------------------------------
+ * pgnotify - ask to be told when memory pressure reaches level, or stop
+ * being told with PP_NONE
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pgnotify(int level)
+{
+  STATWORD ps;
+
+  if (level < PP_NONE || level > PP_CRITICAL) {
+    return SYSERR;
+  }
+  disable(ps);
+  proctab[currpid].ppwant = level;
+  proctab[currpid].pptold = PP_NONE;
+  restore(ps);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * pgpressure - return the current memory pressure level
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pgpressure(void)
+{
+  return frm_pressure();
+}
+
+/*-------------------------------------------------------------------------
+ * pp_update - tell every process that asked about the current pressure
+ * level; called by the writeback daemon, since send() may reschedule
+ *-------------------------------------------------------------------------
+ */
+void pp_update(void)
+{
+  struct pentry *pptr;
+  int pid, level;
+
+  level = frm_pressure();
+  for (pid = 0; pid < NPROC; pid++) {
+    pptr = &proctab[pid];
+    if (pptr->pstate == PRFREE || pptr->ppwant == PP_NONE) {
+      continue;
+    }
+    if (level < pptr->ppwant) {
+      pptr->pptold = PP_NONE;
+    } else if (level > pptr->pptold && send(pid, PP_MSGBASE | level) == OK) {
+      pptr->pptold = level;
+      pp_nsent++;
+    }
+  }
+}
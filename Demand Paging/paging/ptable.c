@@ -0,0 +1,208 @@
+/* ptable.c - pt_unref, pt_reclaim, pt_share, pt_unshare, pt_drop_share */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* A page table frame's fr_refcnt counts its present entries.  When the
+ * last one goes, the table is unhooked from the page directory but kept
+ * with pd_base still pointing at it: a later fault in the same 4MB
+ * hooks it back in without allocating or clearing anything.  Such idle
+ * tables are only freed when frames run short, by pt_reclaim().
+ *
+ * vfork() points the child's heap page directory entry at the parent's
+ * table instead of copying it, since every entry is read-only for
+ * copy-on-write anyway; fr_nshare counts the directories using it, and
+ * each of their present pages holds one fr_refcnt per sharer.  Whoever
+ * is about to change an entry first takes a private copy.
+ */
+unsigned long pt_nreclaim = 0;		/* idle tables freed		*/
+unsigned long pt_nreuse = 0;		/* idle tables hooked back in	*/
+unsigned long pt_nshared = 0;		/* tables vfork() did not copy	*/
+
+/*-------------------------------------------------------------------------
+ * pt_unref - one present entry of the page table at pd[pd_idx] is gone;
+ * unhook the table if that was the last and nobody else uses it
+ *-------------------------------------------------------------------------
+ */
+void pt_unref(pd_t *pd, int pd_idx)
+{
+  int f = (int)pd[pd_idx].pd_base - FRAME0;
+
+  if (f < 0 || f >= NFRAMES) {
+    return;
+  }
+  if (--frm_tab[f].fr_refcnt == 0 && frm_tab[f].fr_nshare <= 1) {
+    pd[pd_idx].pd_pres = 0;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * pt_reuse - return the idle page table pid left at pd[pd_idx], hooked
+ * back in, or NULL if there is none
+ *-------------------------------------------------------------------------
+ */
+pt_t *pt_reuse(int pid, pd_t *pd, int pd_idx)
+{
+  int f = (int)pd[pd_idx].pd_base - FRAME0;
+
+  if (f < 0 || f >= NFRAMES || frm_tab[f].fr_status != FRM_MAPPED ||
+      frm_tab[f].fr_type != FR_TBL || frm_tab[f].fr_pid != pid ||
+      frm_tab[f].fr_vpno != pd_idx << 10 || frm_tab[f].fr_refcnt != 0) {
+    return NULL;
+  }
+  pd[pd_idx].pd_pres = 1;
+  pt_nreuse++;
+  return (pt_t *)((FRAME0 + f) * NBPG);
+}
+
+/*-------------------------------------------------------------------------
+ * pt_reclaim - free every idle page table; return how many there were
+ *-------------------------------------------------------------------------
+ */
+int pt_reclaim(void)
+{
+  int f, n = 0, pd_idx;
+  pd_t *pd;
+
+  for (f = 0; f < NFRAMES; f++) {
+    if (frm_tab[f].fr_status != FRM_MAPPED || frm_tab[f].fr_type != FR_TBL ||
+        frm_tab[f].fr_refcnt != 0 || frm_tab[f].fr_nshare > 1 ||
+        isbadpid(frm_tab[f].fr_pid) ||
+        (pd = (pd_t *)proctab[frm_tab[f].fr_pid].pdbr) == NULL) {
+      continue;
+    }
+    pd_idx = frm_tab[f].fr_vpno >> 10;
+    if (pd[pd_idx].pd_pres || (int)pd[pd_idx].pd_base != FRAME0 + f) {
+      continue;
+    }
+    pd[pd_idx].pd_base = 0;
+    free_frm(f);
+    n++;
+  }
+  pt_nreclaim += n;
+  return n;
+}
+
+/*-------------------------------------------------------------------------
+ * pt_share - make pd[pd_idx] of process pid use the table at ppd[pd_idx]
+ * of the calling process if all its present entries are copy-on-write;
+ * pid's own table there is freed
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pt_share(int pid, pd_t *pd, pd_t *ppd, int pd_idx)
+{
+  int f, own, i;
+  pt_t *pt;
+
+  if (!ppd[pd_idx].pd_pres) {
+    return SYSERR;
+  }
+  f = (int)ppd[pd_idx].pd_base - FRAME0;
+  pt = (pt_t *)((FRAME0 + f) * NBPG);
+  // An xmmap region in the same 4MB keeps the table private
+  for (i = 0; i < 1024; i++) {
+    if (pt[i].pt_pres && !(pt[i].pt_avail & PT_COW)) {
+      return SYSERR;
+    }
+  }
+  for (i = 0; i < 1024; i++) {
+    if (pt[i].pt_pres) {
+      frm_tab[(int)pt[i].pt_base - FRAME0].fr_refcnt++;
+    }
+  }
+  if (frm_tab[f].fr_nshare < 1) {
+    frm_tab[f].fr_nshare = 1;
+  }
+  frm_tab[f].fr_nshare++;
+
+  own = (int)pd[pd_idx].pd_base - FRAME0;
+  if (pd[pd_idx].pd_pres && own >= 0 && own < NFRAMES && own != f) {
+    free_frm(own);
+  }
+  pd[pd_idx] = ppd[pd_idx];
+  pt_nshared++;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * pt_leave - pid stops using shared table frame f; hand the frame to
+ * another user if pid owned it
+ *-------------------------------------------------------------------------
+ */
+static void pt_leave(int pid, int f, int pd_idx)
+{
+  int other;
+  pd_t *opd;
+
+  frm_tab[f].fr_nshare--;
+  if (frm_tab[f].fr_pid != pid) {
+    return;
+  }
+  for (other = 0; other < NPROC; other++) {
+    if (other == pid || proctab[other].pstate == PRFREE ||
+        (opd = (pd_t *)proctab[other].pdbr) == NULL) {
+      continue;
+    }
+    if (opd[pd_idx].pd_pres && (int)opd[pd_idx].pd_base == FRAME0 + f) {
+      frm_tab[f].fr_pid = other;
+      return;
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * pt_unshare - give currpid a private copy of the table at pd[pd_idx] if
+ * it shares it; return the table currpid now uses, or NULL
+ *-------------------------------------------------------------------------
+ */
+pt_t *pt_unshare(pd_t *pd, int pd_idx)
+{
+  int f, n;
+
+  f = (int)pd[pd_idx].pd_base - FRAME0;
+  if (frm_tab[f].fr_nshare <= 1) {
+    return (pt_t *)((FRAME0 + f) * NBPG);
+  }
+  if (get_frm(&n) == SYSERR) {
+    return NULL;
+  }
+  // Making room may have cleared entries of the shared table; the copy
+  // gets them as they are now, refcounts included
+  pg_copy((void *)((FRAME0 + n) * NBPG), (void *)((FRAME0 + f) * NBPG), 1);
+  frm_tab[n].fr_type = FR_TBL;
+  frm_tab[n].fr_vpno = pd_idx << 10;
+  frm_tab[n].fr_refcnt = frm_tab[f].fr_refcnt;
+  frm_tab[n].fr_nshare = 1;
+  pt_leave(currpid, f, pd_idx);
+
+  // Same entries, so the translations already cached stay right; the
+  // invlpg only drops the cached directory entry
+  pd[pd_idx].pd_base = (unsigned int)(FRAME0 + n);
+  invltlb((unsigned long)pd_idx << 22);
+  return (pt_t *)((FRAME0 + n) * NBPG);
+}
+
+/*-------------------------------------------------------------------------
+ * pt_drop_share - pid is exiting and shares the table at pd[pd_idx];
+ * release its references to the pages without touching the entries the
+ * other sharers still use
+ *-------------------------------------------------------------------------
+ */
+void pt_drop_share(int pid, pd_t *pd, int pd_idx)
+{
+  int f, i;
+  pt_t *pt;
+
+  f = (int)pd[pd_idx].pd_base - FRAME0;
+  pt = (pt_t *)((FRAME0 + f) * NBPG);
+  for (i = 0; i < 1024; i++) {
+    if (pt[i].pt_pres) {
+      cow_drop((int)pt[i].pt_base - FRAME0, pid);
+    }
+  }
+  pt_leave(pid, f, pd_idx);
+  pd[pd_idx].pd_pres = 0;
+  pd[pd_idx].pd_base = 0;
+}
@@ -5,6 +5,9 @@
 #include <proc.h>
 #include <paging.h>
 
+/* Pages zero-filled instead of read, because they were never written */
+unsigned long bs_nzfill = 0;
+
 /*-------------------------------------------------------------------------
  * read_bs - read the specified page from the backing store corresponding 
  * to bs_id into dst.
@@ -15,12 +18,12 @@
 SYSCALL read_bs(char *dst, bsd_t bs_id, int page) {
 
   // Check illegal bs_id
-  if (bs_id < 0 || bs_id > 7) {
+  if (bs_id < 0 || bs_id >= MAX_BS) {
     return SYSERR;
   }
 
   // Check illegal page
-  if (page < 0 || page > 255) {
+  if (page < 0 || page >= BS_MAXPAGES) {
     return SYSERR;
   }
 
@@ -29,11 +32,57 @@ SYSCALL read_bs(char *dst, bsd_t bs_id, int page) {
     return SYSERR;
   }
 
-  char *phy_addr = (char *)(BACKING_STORE_BASE + bs_id * BACKING_STORE_UNIT_SIZE + page * NBPG);
+  tr_event(TR_READ, currpid, bs_id, page);
+
+  // Nothing was ever stored there, so there is nothing to copy
+  if (!bs_written(bs_id, page)) {
+    pg_zero(dst);
+    bs_nzfill++;
+    return OK;
+  }
+
+  // The compressed tier expands its pages straight into dst
+  if (bs_zipped(bs_id, page)) {
+    return zs_load(dst, bs_id, page);
+  }
 
-  bcopy((void *)phy_addr, (void *)dst, NBPG);
+  // Any other written page has space in the pool
+  pg_copy(dst, bs_addr(bs_id, page), 1);
 
   return OK;
 }
 
 
+
+/*-------------------------------------------------------------------------
+ * read_bs_v - read n pages of backing store bs_id into frames; vec[k]
+ * names the store page and the frm_tab index it goes to.  Runs that are
+ * contiguous both in the store and in memory are moved with one pg_copy;
+ * pages not in the pool are read one at a time.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL read_bs_v(bsd_t bs_id, bsvec_t *vec, int n)
+{
+  int k, run;
+
+  if (bs_id < 0 || bs_id >= MAX_BS || vec == NULL || n < 0 ||
+      bsv_check(vec, n) == SYSERR) {
+    return SYSERR;
+  }
+
+  for (k = 0; k < n; k += run) {
+    run = 1;
+    if (!bs_written(bs_id, vec[k].bv_page) || bs_zipped(bs_id, vec[k].bv_page)) {
+      read_bs((char *)((FRAME0 + vec[k].bv_frm) * NBPG), bs_id, vec[k].bv_page);
+      continue;
+    }
+    for (; run < bsv_run(bs_id, vec + k, n - k) &&
+         bs_written(bs_id, vec[k + run].bv_page) &&
+         !bs_zipped(bs_id, vec[k + run].bv_page); run++)
+      ;
+    tr_event(TR_READ, currpid, bs_id, vec[k].bv_page);
+    pg_copy((void *)((FRAME0 + vec[k].bv_frm) * NBPG),
+            bs_addr(bs_id, vec[k].bv_page), run);
+  }
+  return OK;
+}
@@ -0,0 +1,151 @@
+/* rss.c - rsslimit, resident set accounting and working set estimate */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+extern unsigned long ctr1000;
+
+/* A resident page is charged to the process named by fr_pid when it is
+ * handed to the replacement policy and uncharged when it leaves it, so
+ * proctab[pid].prss always counts the heap and xmmap pages pid holds.
+ * The working set is the part of those pages whose reference bit was
+ * seen set during the last WS_TAU_MS.
+ */
+static int rss_pid[NFRAMES];		/* process charged, or -1	*/
+static unsigned long ws_seen[NFRAMES];	/* ctr1000 when last referenced	*/
+static int ws_ticks = WS_SCAN;		/* pr_clock() calls to next scan */
+
+/*-------------------------------------------------------------------------
+ * rss_init - no frame is charged to anyone
+ *-------------------------------------------------------------------------
+ */
+void rss_init(void)
+{
+  int i;
+  for (i = 0; i < NFRAMES; i++) {
+    rss_pid[i] = -1;
+    ws_seen[i] = 0;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * rss_charge - count resident page frame frm_idx against its owner
+ *-------------------------------------------------------------------------
+ */
+void rss_charge(int frm_idx)
+{
+  int pid = frm_tab[frm_idx].fr_pid;
+
+  if (rss_pid[frm_idx] != -1 || isbadpid(pid)) {
+    return;
+  }
+  rss_pid[frm_idx] = pid;
+  proctab[pid].prss++;
+  ws_seen[frm_idx] = ctr1000;		/* it was just faulted on	*/
+}
+
+/*-------------------------------------------------------------------------
+ * rss_uncharge - frame frm_idx no longer counts against anyone
+ *-------------------------------------------------------------------------
+ */
+void rss_uncharge(int frm_idx)
+{
+  if (rss_pid[frm_idx] == -1) {
+    return;
+  }
+  proctab[rss_pid[frm_idx]].prss--;
+  rss_pid[frm_idx] = -1;
+}
+
+/*-------------------------------------------------------------------------
+ * rss_tick - called from pr_clock(); every WS_SCAN calls, sample the
+ * reference bits and recount each process's working set
+ *
+ * The bits are only read, never cleared, so the replacement policies
+ * see them exactly as before.
+ *-------------------------------------------------------------------------
+ */
+void rss_tick(void)
+{
+  int i, pid;
+  pt_t *pte;
+
+  if (--ws_ticks > 0) {
+    return;
+  }
+  ws_ticks = WS_SCAN;
+
+  for (pid = 0; pid < NPROC; pid++) {
+    proctab[pid].pwss = 0;
+  }
+  for (i = 0; i < NFRAMES; i++) {
+    if ((pid = rss_pid[i]) == -1) {
+      continue;
+    }
+    if ((pte = frm_pte(i)) != NULL && pte->pt_acc) {
+      ws_seen[i] = ctr1000;
+    }
+    if (ctr1000 - ws_seen[i] < WS_TAU_MS) {
+      proctab[pid].pwss++;
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * rss_victim - choose one of pid's own private pages to replace, or
+ * SYSERR if it has none
+ *
+ * A second-chance clock over pid's frames; a referenced page is moved
+ * into the working set and passed over once.
+ *-------------------------------------------------------------------------
+ */
+int rss_victim(int pid)
+{
+  struct pentry *pptr = &proctab[pid];
+  pt_t *pte;
+  int i, n;
+
+  for (n = 0; n < 2 * NFRAMES; n++) {
+    i = pptr->prss_hand;
+    pptr->prss_hand = (i + 1) % NFRAMES;
+    if (rss_pid[i] != pid || frm_tab[i].fr_refcnt > 1 || frm_tab[i].fr_pin ||
+        (pte = frm_pte(i)) == NULL) {
+      continue;
+    }
+    if (!pte->pt_acc) {
+      return i;
+    }
+    ws_seen[i] = ctr1000;
+    pte->pt_acc = 0;
+    // Otherwise the cached translation never sets the bit again
+    if (pid == currpid) {
+      invltlb((unsigned long)frm_tab[i].fr_vpno << 12);
+    }
+  }
+  return SYSERR;
+}
+
+/*-------------------------------------------------------------------------
+ * rsslimit - set pid's soft and hard frame quotas (0 for no limit)
+ *
+ * Meant to be called between vcreate() and resume().  A process over its
+ * hard quota replaces its own pages on every fault; one over the soft
+ * quota does so only while free frames are scarce.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL rsslimit(int pid, int soft, int hard)
+{
+  STATWORD ps;
+
+  if (isbadpid(pid) || proctab[pid].pstate == PRFREE ||
+      soft < 0 || hard < 0 || (hard > 0 && soft > hard)) {
+    return SYSERR;
+  }
+  disable(ps);
+  proctab[pid].prss_soft = soft;
+  proctab[pid].prss_hard = hard;
+  restore(ps);
+  return OK;
+}
@@ -0,0 +1,310 @@
+/* stack.c - stk_init, stk_map, stk_alloc, stk_grow, stk_free, stk_refill, dfint */
+
+#include <conf.h>
+#include <kernel.h>
+#include <i386.h>
+#include <proc.h>
+#include <paging.h>
+
+/* Processes made by vcreate() run on stacks in a paged area that every
+ * page directory shares.  Process pid owns the STK_SLOT pages from
+ * STK_VPNO + pid * STK_SLOT up.  Only the top page is mapped at
+ * create(); the rest are mapped one at a time as they are touched, down
+ * to the create() size.  The lowest page of the slot is never mapped, so
+ * a process running off its stack hits it and is killed.  Stack frames
+ * are FR_STK: they have no store, never go on the replacement policy and
+ * are freed when the process dies.  The area's page tables and the pool
+ * below are only set up by the first vcreate(), so a system that never
+ * makes one uses no frames for it.
+ *
+ * Most growth cannot go through pfint(): a push onto a missing page
+ * leaves the CPU nowhere to put the fault frame, and the nested fault
+ * becomes a double fault.  That comes in through a task gate to the
+ * second TSS, which runs dfint() on a stack of its own with the CPU
+ * state of the process saved in the first.  The state saved on a double
+ * fault is formally undefined, but the CPU saves the state from before
+ * the faulting instruction, so switching back retries it.  If the
+ * process had interrupts off it may have been inside the frame
+ * allocator, so the page then comes from a small pool filled ahead of
+ * time.
+ */
+int stk_paged = 0;			/* next create() gets a paged stack */
+unsigned long stk_ngrow = 0;		/* pages added to running stacks */
+unsigned long stk_ndouble = 0;		/* of those, on a double fault	*/
+unsigned long stk_noverflow = 0;	/* processes killed at the guard */
+
+static int stk_ready = 0;		/* stk_pt[] holds the tables	*/
+static int stk_pt[STK_NPT];		/* frames of the area's tables	*/
+static int stk_pool[STK_NPOOL];		/* frames kept for dfint()	*/
+static int stk_npool = 0;
+static int stk_dead = BADPID;		/* exited; stack not freed yet	*/
+static unsigned long df_stack[DF_STKWORDS];
+
+extern struct idt idt[];
+extern unsigned long read_cr2(void);
+extern void dfintr(void);
+
+/*-------------------------------------------------------------------------
+ * stk_pte - return the PTE of page vpno of the stack area
+ *-------------------------------------------------------------------------
+ */
+static pt_t *stk_pte(int vpno)
+{
+  pt_t *pt = (pt_t *)((FRAME0 + stk_pt[(vpno - STK_VPNO) >> 10]) * NBPG);
+
+  return &pt[vpno & 0x3FF];
+}
+
+/*-------------------------------------------------------------------------
+ * stk_mapin - give page vpno of pid's stack a frame, from the pool only
+ * if pool_only is set
+ *-------------------------------------------------------------------------
+ */
+static SYSCALL stk_mapin(int pid, int vpno, int pool_only)
+{
+  pt_t *pte = stk_pte(vpno);
+  int f;
+
+  if (pte->pt_pres) {
+    return OK;
+  }
+  if (stk_npool > 0) {
+    f = stk_pool[--stk_npool];
+  } else if (pool_only || get_frm_vp(&f, vpno) == SYSERR) {
+    return SYSERR;
+  }
+  frm_tab[f].fr_type = FR_STK;
+  frm_tab[f].fr_pid = pid;
+  frm_tab[f].fr_vpno = vpno;
+  frm_tab[f].fr_refcnt = 1;
+  frm_tab[stk_pt[(vpno - STK_VPNO) >> 10]].fr_refcnt++;
+  pte->pt_base = FRAME0 + f;
+  pte->pt_write = 1;
+  pte->pt_pres = 1;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * stk_unmap - free every page of pid's stack slot
+ *-------------------------------------------------------------------------
+ */
+static void stk_unmap(int pid)
+{
+  pt_t *pte;
+  int v;
+
+  for (v = stk_slot(pid); v < stk_slot(pid) + STK_SLOT; v++) {
+    pte = stk_pte(v);
+    if (!pte->pt_pres) {
+      continue;
+    }
+    pte->pt_pres = 0;
+    // The creator wrote the initial frame and may still cache the page
+    invltlb((unsigned long)v << 12);
+    frm_tab[stk_pt[(v - STK_VPNO) >> 10]].fr_refcnt--;
+    free_frm((int)pte->pt_base - FRAME0);
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * stk_reap - free the stack of the last process that killed itself, once
+ * it no longer runs on it
+ *-------------------------------------------------------------------------
+ */
+static void stk_reap(void)
+{
+  if (stk_dead != BADPID && stk_dead != currpid) {
+    stk_unmap(stk_dead);
+    stk_dead = BADPID;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * stk_refill - top up the frames dfint() may use
+ *-------------------------------------------------------------------------
+ */
+void stk_refill(void)
+{
+  int f;
+
+  while (stk_ready && stk_npool < STK_NPOOL && get_frm(&f) == OK) {
+    frm_tab[f].fr_type = FR_STK;
+    frm_tab[f].fr_pid = NULLPROC;
+    stk_pool[stk_npool++] = f;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * stk_map - hook the stack area into page directory pd
+ *-------------------------------------------------------------------------
+ */
+void stk_map(pd_t *pd)
+{
+  int i;
+
+  if (!stk_ready) {
+    return;
+  }
+  for (i = 0; i < STK_NPT; i++) {
+    pd[STK_PDE + i].pd_pres = 1;
+    pd[STK_PDE + i].pd_write = 1;
+    pd[STK_PDE + i].pd_base = FRAME0 + stk_pt[i];
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * stk_setup - allocate the stack area's page tables and hook them into
+ * every page directory there is
+ *-------------------------------------------------------------------------
+ */
+static SYSCALL stk_setup(void)
+{
+  int i, pid;
+
+  for (i = 0; i < STK_NPT; i++) {
+    if (get_frm(&stk_pt[i]) == SYSERR) {
+      while (--i >= 0) {
+        free_frm(stk_pt[i]);
+      }
+      return SYSERR;
+    }
+    pg_fill((void *)((FRAME0 + stk_pt[i]) * NBPG), PT_EMPTY);
+    frm_tab[stk_pt[i]].fr_type = FR_STK;
+    frm_tab[stk_pt[i]].fr_pid = NULLPROC;
+    frm_tab[stk_pt[i]].fr_vpno = STK_VPNO + (i << 10);
+  }
+  stk_ready = 1;
+
+  // The null process's directory serves the double fault task too
+  for (pid = 0; pid < NPROC; pid++) {
+    if ((pid == NULLPROC || proctab[pid].pstate != PRFREE) &&
+        proctab[pid].pdbr != 0) {
+      stk_map((pd_t *)proctab[pid].pdbr);
+    }
+  }
+  stk_refill();
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * stk_init - set up the double fault task
+ *-------------------------------------------------------------------------
+ */
+void stk_init(void)
+{
+  struct tss *t = &i386_tasks[1];
+  struct idt *pidt = &idt[8];
+
+  // dfintr runs with interrupts off in the kernel segments and the null
+  // process's page directory, which has the whole stack area
+  t->ts_pdbr = proctab[NULLPROC].pdbr;
+  t->ts_eip = (unsigned int)dfintr;
+  t->ts_efl = 0x2;
+  t->ts_esp = (unsigned int)&df_stack[DF_STKWORDS];
+  t->ts_cs = 0x8;
+  t->ts_ss = 0x18;
+  t->ts_ds = t->ts_es = t->ts_fs = t->ts_gs = 0x10;
+
+  pidt->igd_loffset = 0;
+  pidt->igd_segsel = 0x30;	/* the second TSS */
+  pidt->igd_mbz = 0;
+  pidt->igd_type = IGDT_TASK;
+  pidt->igd_dpl = 0;
+  pidt->igd_present = 1;
+  pidt->igd_hoffset = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * stk_alloc - map the top page of a new stack for pid; return the
+ * address of its top word, as getstk() does, or SYSERR
+ *-------------------------------------------------------------------------
+ */
+unsigned long *stk_alloc(int pid)
+{
+  int top = stk_slot(pid) + STK_SLOT;
+
+  if (!stk_ready && stk_setup() == SYSERR) {
+    return (unsigned long *)SYSERR;
+  }
+  stk_reap();
+  // A create() that failed after its stack was set up left it behind
+  stk_unmap(pid);
+  if (stk_mapin(pid, top - 1, 0) == SYSERR) {
+    return (unsigned long *)SYSERR;
+  }
+  stk_refill();
+  return (unsigned long *)(((unsigned long)top << 12) - sizeof(long));
+}
+
+/*-------------------------------------------------------------------------
+ * stk_grow - map page vpno of pid's stack if it lies within the size
+ * given to create()
+ *-------------------------------------------------------------------------
+ */
+SYSCALL stk_grow(int pid, int vpno, int pool_only)
+{
+  struct pentry *pptr = &proctab[pid];
+  int top = stk_slot(pid) + STK_SLOT;
+
+  if (!stk_area(pptr->pbase >> 12) || vpno >= top ||
+      vpno < top - (pptr->pstklen + NBPG - 1) / NBPG ||
+      stk_mapin(pid, vpno, pool_only) == SYSERR) {
+    return SYSERR;
+  }
+  stk_ngrow++;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * stk_free - free the paged stack of pid as it exits; a process killing
+ * itself keeps it until the next create() or kill()
+ *-------------------------------------------------------------------------
+ */
+void stk_free(int pid)
+{
+  stk_reap();
+  if (pid == currpid) {
+    stk_dead = pid;
+  } else {
+    stk_unmap(pid);
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * stk_die - where a process that overflowed its stack resumes
+ *-------------------------------------------------------------------------
+ */
+static void stk_die(void)
+{
+  kill(currpid);
+}
+
+/*-------------------------------------------------------------------------
+ * dfint - handle a double fault for the process whose state is in the
+ * first TSS; called from dfintr in the double fault task
+ *-------------------------------------------------------------------------
+ */
+void dfint(void)
+{
+  struct tss *t = &i386_tasks[0];
+  unsigned long addr = read_cr2();
+
+  if (stk_area(addr >> 12) &&
+      stk_grow(currpid, (int)(addr >> 12), !(t->ts_efl & EFLAGS_IF)) == OK) {
+    stk_ndouble++;
+  } else {
+    if (stk_area(addr >> 12)) {
+      stk_noverflow++;
+      kprintf("Stack overflow by pid %d at 0x%08x - killing process\n",
+              currpid, addr);
+    } else {
+      kprintf("Double fault by pid %d at 0x%08x - killing process\n",
+              currpid, addr);
+    }
+    // Its stack is no use any more; finish it on the top of it
+    t->ts_esp = t->ts_ebp = proctab[currpid].pbase;
+    t->ts_eip = (unsigned int)stk_die;
+  }
+  // Switching back reloads CR3 from here
+  t->ts_pdbr = proctab[currpid].pdbr;
+}
@@ -0,0 +1,117 @@
+/* trace.c - trace, trace_read, pgstat: paging event trace */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+extern unsigned long ctr1000;
+
+/* Events go into a ring of TR_NREC records that is overwritten once it
+ * wraps.  A writer claims a slot with one xadd on tr_head, so it never
+ * waits, and sets tr_seq last; a reader keeps its own position and
+ * trusts a record only if tr_seq is the number it expected both before
+ * and after copying it.  Records overwritten before they were read are
+ * skipped and counted in tr_nlost.
+ */
+static trrec_t tr_ring[TR_NREC];
+static volatile unsigned long tr_head = 0;	/* next event number	*/
+int tr_mask = 0;			/* TR_* events being recorded	*/
+unsigned long tr_nlost = 0;		/* overwritten before read	*/
+
+/*-------------------------------------------------------------------------
+ * trace - record the TR_* events in mask from now on; 0 stops tracing
+ *-------------------------------------------------------------------------
+ */
+SYSCALL trace(int mask)
+{
+  if (mask & ~TR_ALL) {
+    return SYSERR;
+  }
+  tr_mask = mask;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * tr_log - append one event to the ring; use tr_event() instead
+ *-------------------------------------------------------------------------
+ */
+void tr_log(int type, int pid, int a, int b)
+{
+  unsigned long seq = 1;
+  trrec_t *r;
+
+  __asm__ __volatile__ ("xaddl %0, %1" : "+r"(seq), "+m"(tr_head));
+  r = &tr_ring[seq & (TR_NREC - 1)];
+  r->tr_seq = ~0UL;
+  r->tr_ms = ctr1000;
+  r->tr_type = type;
+  r->tr_pid = pid;
+  r->tr_a = a;
+  r->tr_b = b;
+  __asm__ __volatile__ ("" : : : "memory");
+  r->tr_seq = seq;
+}
+
+/*-------------------------------------------------------------------------
+ * trace_read - copy up to max events from *pos on into buf and advance
+ * *pos past them; return how many were copied
+ *
+ * Start with *pos = 0.  Nothing is locked, so this can run while events
+ * are being recorded.
+ *-------------------------------------------------------------------------
+ */
+int trace_read(unsigned long *pos, trrec_t *buf, int max)
+{
+  volatile trrec_t *r;
+  unsigned long head;
+  int n = 0;
+
+  if (pos == NULL || buf == NULL || max < 0) {
+    return SYSERR;
+  }
+  while (n < max && *pos != (head = tr_head)) {
+    if (head - *pos > TR_NREC) {
+      tr_nlost += head - TR_NREC - *pos;
+      *pos = head - TR_NREC;
+    }
+    r = &tr_ring[*pos & (TR_NREC - 1)];
+    if (r->tr_seq == *pos) {
+      buf[n].tr_seq = *pos;
+      buf[n].tr_ms = r->tr_ms;
+      buf[n].tr_type = r->tr_type;
+      buf[n].tr_pid = r->tr_pid;
+      buf[n].tr_a = r->tr_a;
+      buf[n].tr_b = r->tr_b;
+      if (r->tr_seq == *pos) {
+        n++;
+        (*pos)++;
+        continue;
+      }
+    }
+    // Reused under us; the ring has moved on past this one
+    tr_nlost++;
+    (*pos)++;
+  }
+  return n;
+}
+
+/*-------------------------------------------------------------------------
+ * pgstat - copy pid's paging counters into ps
+ *-------------------------------------------------------------------------
+ */
+SYSCALL pgstat(int pid, pgstat_t *ps)
+{
+  struct pentry *pptr;
+
+  if (isbadpid(pid) || proctab[pid].pstate == PRFREE || ps == NULL) {
+    return SYSERR;
+  }
+  pptr = &proctab[pid];
+  ps->ps_majflt = pptr->pmajflt;
+  ps->ps_minflt = pptr->pminflt;
+  ps->ps_evict = pptr->pnevict;
+  ps->ps_pgin = pptr->ppgin;
+  ps->ps_pgout = pptr->ppgout;
+  return OK;
+}
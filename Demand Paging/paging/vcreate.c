@@ -9,8 +9,6 @@
 #include <io.h>
 #include <paging.h>
 
-extern unsigned long global_pt_addrs[4];
-
 /*
 static unsigned long esp;
 */
@@ -34,7 +32,6 @@ SYSCALL vcreate(procaddr,ssize,hsize,priority,name,nargs,args)
 	STATWORD 	ps;    
 	int		pid;		/* stores new process id	*/
 	struct	pentry	*pptr;		/* pointer to proc. table entry */
-	int		i;
 	int		bs_id;		/* backing store ID */
 	int		pd_frame_idx;	/* page directory frame index */
 	int		pt_frame_idx;	/* page table frame index */
@@ -52,20 +49,19 @@ SYSCALL vcreate(procaddr,ssize,hsize,priority,name,nargs,args)
 		return(SYSERR);
 	}
 
-	// Validate heap size (should be 256 pages for pages 4096-4351)
-	if (hsize > 0 && hsize <= 256) {
+	// Validate heap size; the largest heap (pages 4096-5119) fits the
+	// one page table set up below.  Store space for the whole heap is
+	// reserved by bsm_map(), which fails if the pool cannot cover it.
+	if (hsize > 0 && hsize <= BS_MAXPAGES) {
 		vhpnpages = hsize;
 	}
 	
-	// Temporarily enable interrupts before calling create() since it manages its own interrupt state
-	restore(ps);
-	
-	// Use create() to handle stack creation and basic process setup
+	// Use create() to handle stack creation and basic process setup; it
+	// runs with interrupts still off, so the paged stack asked for here
+	// cannot go to some other process's create()
+	stk_paged = 1;
 	pid = create(procaddr, ssize, priority, name, nargs, args);
 	
-	// Re-disable interrupts for remaining work
-	disable(ps);
-	
 	if (pid == SYSERR) {
 		free_bsm(bs_id);
 		restore(ps);
@@ -92,19 +88,7 @@ SYSCALL vcreate(procaddr,ssize,hsize,priority,name,nargs,args)
 	pt = (pt_t *)pt_phys_addr;
 	
 	// Initialize all page table entries as not present (will cause page faults)
-	for (i = 0; i < 1024; i++) {
-		pt[i].pt_pres = 0;
-		pt[i].pt_write = 1;
-		pt[i].pt_user = 0;
-		pt[i].pt_pwt = 0;
-		pt[i].pt_pcd = 0;
-		pt[i].pt_acc = 0;
-		pt[i].pt_dirty = 0;
-		pt[i].pt_mbz = 0;
-		pt[i].pt_global = 0;
-		pt[i].pt_avail = 0;
-		pt[i].pt_base = 0;
-	}
+	pg_fill(pt, PT_EMPTY);
 
 	// Update page directory entry 4 to point to this page table
 	pd[4].pd_pres = 1;
@@ -130,10 +114,11 @@ SYSCALL vcreate(procaddr,ssize,hsize,priority,name,nargs,args)
 	// Update frame table for page table
 	frm_tab[pt_frame_idx].fr_status = FRM_MAPPED;
 	frm_tab[pt_frame_idx].fr_pid = pid;
-	frm_tab[pt_frame_idx].fr_vpno = 0;
+	frm_tab[pt_frame_idx].fr_vpno = 4 << 10;
 	frm_tab[pt_frame_idx].fr_refcnt = 0;
 	frm_tab[pt_frame_idx].fr_type = FR_TBL;
 	frm_tab[pt_frame_idx].fr_dirty = 0;
+	frm_tab[pt_frame_idx].fr_nshare = 1;
 
 	// Add entry to bsm_tab for virtual heap
 	if (bsm_map(pid, vhpno, bs_id, vhpnpages) == SYSERR) {
@@ -149,57 +134,11 @@ SYSCALL vcreate(procaddr,ssize,hsize,priority,name,nargs,args)
 	pptr->vhpno = vhpno;
 	pptr->vhpnpages = vhpnpages;
 
-	// Initialize virtual heap free list
-	// vmemlist points to a header structure at the beginning of virtual heap
+	// The allocator state lives in vh_tab, so nothing in the heap has to
+	// be written (or faulted in) until vgetmem() hands it out; vmemlist
+	// just marks that the process has a heap
 	pptr->vmemlist = (struct mblock *)(vhpno * NBPG);
-	
-	// Map the first page of the virtual heap to initialize the free list header
-	// This is needed so vgetmem can access the header without causing a fault
-	int first_page_frm_idx;
-	if (get_frm(&first_page_frm_idx) == OK) {
-		unsigned long first_page_phys = (FRAME0 + first_page_frm_idx) * NBPG;
-		
-		// Read from backing store to initialize the page
-		if (read_bs((char *)first_page_phys, (bsd_t)bs_id, 0) == OK) {
-			// Now initialize the page table entry for the first virtual heap page
-			pt[0].pt_pres = 1;
-			pt[0].pt_write = 1;
-			pt[0].pt_user = 0;
-			pt[0].pt_base = (unsigned int)(FRAME0 + first_page_frm_idx);
-			
-			// Initialize free list header and first block using physical address
-			// (we can access it directly since we're mapping kernel space)
-			struct mblock *vheader = (struct mblock *)first_page_phys;
-			// mnext should point to the next block in virtual address space
-			vheader->mnext = (struct mblock *)((vhpno * NBPG) + sizeof(struct mblock));
-			vheader->mlen = 0;  // Dummy header node
-			
-			// Initialize first free block (at offset sizeof(struct mblock))
-			struct mblock *first_block_phys = (struct mblock *)((unsigned)vheader + sizeof(struct mblock));
-			first_block_phys->mnext = (struct mblock *)NULL;
-			first_block_phys->mlen = vhpnpages * NBPG;
-			
-			// Update frame table
-			frm_tab[first_page_frm_idx].fr_status = FRM_MAPPED;
-			frm_tab[first_page_frm_idx].fr_pid = pid;
-			frm_tab[first_page_frm_idx].fr_vpno = vhpno;
-			frm_tab[first_page_frm_idx].fr_refcnt = 1;
-			frm_tab[first_page_frm_idx].fr_type = FR_PAGE;
-			frm_tab[first_page_frm_idx].fr_dirty = 0;
-			
-			// Add frame to Second-Chance queue
-			{
-				extern void add_to_sc_queue(int frm_idx);
-				add_to_sc_queue(first_page_frm_idx);
-			}
-			
-			// Increment ref count of page table
-			frm_tab[pt_frame_idx].fr_refcnt++;
-		} else {
-			// If read_bs fails, free the frame
-			free_frm(first_page_frm_idx);
-		}
-	}
+	vh_init(pid, vhpno, vhpnpages);
 
 	restore(ps);
 
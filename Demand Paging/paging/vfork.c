@@ -0,0 +1,289 @@
+/* vfork.c - vfork, cow_fault, cow_writeback, cow_unmap, cow_drop */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* A frame shared copy-on-write is mapped read-only with PT_COW set in
+ * every sharer's page table, at the same vpno (the heap always starts at
+ * page 4096).  fr_refcnt counts the sharers and fr_pid names one of them,
+ * which the replacement policies use for the reference bit.  Dirty state
+ * from before the fork is kept in fr_dirty, since the read-only PTEs can
+ * no longer set pt_dirty.
+ */
+
+/*-------------------------------------------------------------------------
+ * cow_pte - return pid's page table entry for vpno if it maps frm_idx
+ *-------------------------------------------------------------------------
+ */
+pt_t *cow_pte(int pid, int vpno, int frm_idx)
+{
+  pd_t *pd;
+  pt_t *pt;
+
+  if (proctab[pid].pstate == PRFREE || proctab[pid].pdbr == 0) {
+    return NULL;
+  }
+  pd = (pd_t *)proctab[pid].pdbr;
+  if (!pd[(vpno >> 10) & 0x3FF].pd_pres) {
+    return NULL;
+  }
+  pt = (pt_t *)(pd[(vpno >> 10) & 0x3FF].pd_base << 12);
+  pt = &pt[vpno & 0x3FF];
+  if (!pt->pt_pres || (int)pt->pt_base != FRAME0 + frm_idx) {
+    return NULL;
+  }
+  return pt;
+}
+
+/*-------------------------------------------------------------------------
+ * cow_writeback - write shared frame frm_idx to the heap store of every
+ * sharer if it is dirty, and mark it clean
+ *-------------------------------------------------------------------------
+ */
+SYSCALL cow_writeback(int frm_idx)
+{
+  int pid, vpno, dirty;
+  pt_t *pte;
+  vregion_t *vr;
+
+  vpno = frm_tab[frm_idx].fr_vpno;
+  dirty = frm_tab[frm_idx].fr_dirty;
+  for (pid = 0; pid < NPROC && !dirty; pid++) {
+    if ((pte = cow_pte(pid, vpno, frm_idx)) != NULL && pte->pt_dirty) {
+      dirty = 1;
+    }
+  }
+  if (!dirty) {
+    return OK;
+  }
+
+  for (pid = 0; pid < NPROC; pid++) {
+    if ((pte = cow_pte(pid, vpno, frm_idx)) == NULL) {
+      continue;
+    }
+    if ((vr = vr_lookup(pid, vpno)) == NULL ||
+        write_bs((char *)((FRAME0 + frm_idx) * NBPG), (bsd_t)vr->vr_bs_id,
+                 vpno - vr->vr_vpno) == SYSERR) {
+      kprintf("cow_writeback: write failed for pid %d vpno %d\n", pid, vpno);
+      return SYSERR;
+    }
+    pte->pt_dirty = 0;
+    pg_paged_out(pid, 1);
+    tr_event(TR_WB, pid, vpno, 1);
+  }
+  frm_tab[frm_idx].fr_dirty = 0;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * cow_unmap - remove shared frame frm_idx from every sharer's page table
+ *-------------------------------------------------------------------------
+ */
+SYSCALL cow_unmap(int frm_idx)
+{
+  int pid, vpno;
+  pt_t *pte;
+
+  vpno = frm_tab[frm_idx].fr_vpno;
+  for (pid = 0; pid < NPROC; pid++) {
+    if ((pte = cow_pte(pid, vpno, frm_idx)) == NULL) {
+      continue;
+    }
+    pte->pt_pres = 0;
+    pt_unref((pd_t *)proctab[pid].pdbr, (vpno >> 10) & 0x3FF);
+  }
+  // Sharers of one page table clear the same entry, found only through
+  // the first of them, so the running one may not have been seen
+  invltlb((unsigned long)vpno << 12);
+  frm_tab[frm_idx].fr_refcnt = 0;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * cow_drop - pid no longer maps shared frame frm_idx; hand the frame to
+ * another sharer if pid was its owner
+ *-------------------------------------------------------------------------
+ */
+SYSCALL cow_drop(int frm_idx, int pid)
+{
+  int other;
+
+  frm_tab[frm_idx].fr_refcnt--;
+  if (frm_tab[frm_idx].fr_pid != pid) {
+    return OK;
+  }
+  for (other = 0; other < NPROC; other++) {
+    if (other != pid &&
+        cow_pte(other, frm_tab[frm_idx].fr_vpno, frm_idx) != NULL) {
+      frm_tab[frm_idx].fr_pid = other;
+      rss_uncharge(frm_idx);
+      rss_charge(frm_idx);
+      return OK;
+    }
+  }
+  return SYSERR;
+}
+
+/*-------------------------------------------------------------------------
+ * cow_fault - resolve a write to the copy-on-write page pte of currpid
+ *
+ * The last sharer simply gets the page back writable; anyone else gets
+ * a private copy.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL cow_fault(pt_t *pte, int vpno)
+{
+  int old_frm, new_frm;
+
+  old_frm = (int)pte->pt_base - FRAME0;
+  if (frm_tab[old_frm].fr_refcnt > 1) {
+    rss_trim();
+    if (get_frm_vp(&new_frm, vpno) == SYSERR) {
+      return SYSERR;
+    }
+    // Making room may have evicted the shared frame; if so the retried
+    // write faults again and reads our own store instead
+    if (!pte->pt_pres || (int)pte->pt_base != FRAME0 + old_frm) {
+      free_frm(new_frm);
+      return OK;
+    }
+
+    pg_copy((void *)((FRAME0 + new_frm) * NBPG),
+            (void *)((FRAME0 + old_frm) * NBPG), 1);
+    pte->pt_base = (unsigned int)(FRAME0 + new_frm);
+    cow_drop(old_frm, currpid);
+
+    frm_tab[new_frm].fr_status = FRM_MAPPED;
+    frm_tab[new_frm].fr_pid = currpid;
+    frm_tab[new_frm].fr_vpno = vpno;
+    frm_tab[new_frm].fr_refcnt = 1;
+    frm_tab[new_frm].fr_type = FR_PAGE;
+    frm_tab[new_frm].fr_dirty = frm_tab[old_frm].fr_dirty;
+    pr_insert(new_frm);
+  }
+
+  pte->pt_write = 1;
+  pte->pt_avail &= ~PT_COW;
+  invltlb((unsigned long)vpno << 12);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * vfork - create a process like vcreate() whose virtual heap starts as a
+ * copy of the caller's
+ *
+ * Resident heap pages are shared read-only and copied on the first
+ * write, and so is the page table mapping them; the rest of the heap is
+ * copied store to store, so the child faults nothing in that the parent
+ * already had in memory.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL vfork(procaddr,ssize,priority,name,nargs,args)
+	int	*procaddr;		/* procedure address		*/
+	int	ssize;			/* stack size in words		*/
+	int	priority;		/* process priority > 0		*/
+	char	*name;			/* name (for debugging)		*/
+	int	nargs;			/* number of args that follow	*/
+	long	args;			/* arguments (treated like an	*/
+					/* array in the code)		*/
+{
+  STATWORD ps;
+  struct pentry *parent, *child;
+  int pid, vpno, frm_idx, pt_frm_idx, pd_idx;
+  pd_t *ppd, *cpd;
+  pt_t *ppte, *cpt;
+  tlbbatch_t tb;
+
+  parent = &proctab[currpid];
+  if (!parent->is_virtual) {
+    return SYSERR;
+  }
+
+  pid = vcreate(procaddr, ssize, parent->vhpnpages, priority, name, nargs, args);
+  if (pid == SYSERR) {
+    return SYSERR;
+  }
+
+  disable(ps);
+  child = &proctab[pid];
+  cpd = (pd_t *)child->pdbr;
+  ppd = (pd_t *)parent->pdbr;
+  pt_frm_idx = (int)cpd[(child->vhpno >> 10) & 0x3FF].pd_base - FRAME0;
+  cpt = (pt_t *)((FRAME0 + pt_frm_idx) * NBPG);
+
+  // The child inherits the parent's allocator state; the boundary tags
+  // inside the heap come along with its pages
+  if (copy_bs((bsd_t)child->store, (bsd_t)parent->store, parent->vhpnpages) == SYSERR) {
+    restore(ps);
+    kill(pid);
+    return SYSERR;
+  }
+  vh_tab[pid] = vh_tab[currpid];
+
+  // Write-protecting a big heap is cheaper as one CR3 reload
+  tlb_begin(&tb);
+
+  for (vpno = parent->vhpno; vpno < parent->vhpno + parent->vhpnpages; vpno++) {
+    if (!ppd[(vpno >> 10) & 0x3FF].pd_pres) {
+      continue;
+    }
+    ppte = (pt_t *)(ppd[(vpno >> 10) & 0x3FF].pd_base << 12);
+    ppte = &ppte[vpno & 0x3FF];
+    if (!ppte->pt_pres) {
+      continue;
+    }
+    frm_idx = (int)ppte->pt_base - FRAME0;
+
+    // Locks are not inherited, and a locked page must stay writable in
+    // place; the child starts from a copy in its own store instead
+    if (ppte->pt_avail & PT_LOCK) {
+      if (write_bs((char *)((FRAME0 + frm_idx) * NBPG), (bsd_t)child->store,
+                   vpno - parent->vhpno) == SYSERR) {
+        // Pages already marked are unshared, so their next write just
+        // makes them writable again
+        tlb_flush(&tb);
+        restore(ps);
+        kill(pid);
+        return SYSERR;
+      }
+      continue;
+    }
+
+    // Dirtiness relative to the stores now lives in the frame table
+    if (ppte->pt_dirty) {
+      frm_tab[frm_idx].fr_dirty = 1;
+      ppte->pt_dirty = 0;
+    }
+    ppte->pt_write = 0;
+    ppte->pt_avail |= PT_COW;
+    tlb_add(&tb, currpid, (unsigned long)vpno << 12);
+  }
+  tlb_flush(&tb);
+
+  // Every entry of the heap's table is now the same read-only one the
+  // child needs, so it can simply use the parent's table
+  pd_idx = (parent->vhpno >> 10) & 0x3FF;
+  if (pt_share(pid, cpd, ppd, pd_idx) == OK) {
+    restore(ps);
+    return pid;
+  }
+
+  for (vpno = parent->vhpno; vpno < parent->vhpno + parent->vhpnpages; vpno++) {
+    if (!ppd[(vpno >> 10) & 0x3FF].pd_pres) {
+      continue;
+    }
+    ppte = (pt_t *)(ppd[(vpno >> 10) & 0x3FF].pd_base << 12);
+    ppte = &ppte[vpno & 0x3FF];
+    if (!ppte->pt_pres || (ppte->pt_avail & PT_LOCK)) {
+      continue;
+    }
+    cpt[vpno & 0x3FF] = *ppte;
+    cpt[vpno & 0x3FF].pt_acc = 0;
+    frm_tab[(int)ppte->pt_base - FRAME0].fr_refcnt++;
+    frm_tab[pt_frm_idx].fr_refcnt++;
+  }
+  restore(ps);
+  return pid;
+}
@@ -8,69 +8,79 @@
 
 extern struct pentry proctab[];
 /*------------------------------------------------------------------------
- * vfreemem - free a virtual memory block, returning it to vmemlist
+ * vfreemem - free a virtual memory block, returning it to its free list
+ *
+ * The boundary tags of the two neighbours say whether they are free, so
+ * merging with them is O(1); a block that ends up touching the untouched
+ * top of the heap is given back to it.  Whole pages the free space covers
+ * are discarded, so they are zero-filled rather than paged in if reused.
  *------------------------------------------------------------------------
  */
 SYSCALL	vfreemem(block, size)
 	struct	mblock	*block;
 	unsigned size;
 {
-	STATWORD ps;    
-	struct	mblock	*p, *q;
-	unsigned top;
+	STATWORD ps;
 	struct	pentry	*pptr;
-	unsigned long	vheap_start;
-	unsigned long	vheap_end;
+	vheap_t	*vh;
+	vhblk_t	*b, *n;
+	unsigned	len;
 
 	// Get current process entry
 	pptr = &proctab[currpid];
-	
+	vh = &vh_tab[currpid];
+
 	// Check if process has a virtual heap
 	if (pptr->vmemlist == NULL) {
 		return(SYSERR);
 	}
-	
-	// Calculate virtual heap bounds
-	vheap_start = pptr->vhpno * NBPG;
-	vheap_end = vheap_start + (pptr->vhpnpages * NBPG);
-	
-	if (size == 0 || (unsigned)block < vheap_start || (unsigned)block >= vheap_end) {
+
+	b = (vhblk_t *)((unsigned)block - VB_HDR);
+	if (size == 0 || ((unsigned)block & 07) != 0 ||
+	    (unsigned)b < vh->vh_base || (unsigned)block >= vh->vh_top) {
 		return(SYSERR);
 	}
-	
+
 	size = (unsigned)roundmb(size);
 	disable(ps);
-	
-	// Find the correct position in the free list
-	for (p = pptr->vmemlist->mnext, q = pptr->vmemlist;
-	     p != (struct mblock *) NULL && p < block;
-	     q = p, p = p->mnext) {
-	}
-	
-	// Check for overlapping blocks
-	top = q->mlen + (unsigned)q;
-	if ((top > (unsigned)block && q != pptr->vmemlist) ||
-	    (p != NULL && (size + (unsigned)block) > (unsigned)p)) {
+
+	// Catch double frees and sizes larger than what was allocated
+	len = vb_len(b);
+	if (!(b->vb_size & VB_INUSE) || size + VB_HDR > len) {
 		restore(ps);
 		return(SYSERR);
 	}
-	
-	// Merge with previous block if adjacent
-	if (q != pptr->vmemlist && top == (unsigned)block) {
-		q->mlen += size;
-	} else {
-		block->mlen = size;
-		block->mnext = p;
-		q->mnext = block;
-		q = block;
+
+	// Merge with previous block if it is free
+	if (b->vb_size & VB_PFREE) {
+		b = (vhblk_t *)((unsigned)b - *((unsigned *)b - 1));
+		vh_unlink(vh, b);
+		len += vb_len(b);
+	}
+
+	// Give the block back to the top of the heap if it borders it
+	n = (vhblk_t *)((unsigned)b + len);
+	if ((unsigned)n == vh->vh_top) {
+		vh->vh_top = (unsigned)b;
+		vh_discard((unsigned)b, (unsigned)n);
+		restore(ps);
+		return(OK);
 	}
-	
-	// Merge with next block if adjacent
-	if (p != NULL && (unsigned)(q->mlen + (unsigned)q) == (unsigned)p) {
-		q->mlen += p->mlen;
-		q->mnext = p->mnext;
+
+	// Merge with next block if it is free; free blocks never border
+	// each other or the top, so whatever follows is in use
+	if (!(n->vb_size & VB_INUSE)) {
+		vh_unlink(vh, n);
+		len += vb_len(n);
+		n = (vhblk_t *)((unsigned)b + len);
 	}
-	
+	n->vb_size |= VB_PFREE;
+	vh_link(vh, b, len);
+
+	// Only the links and the trailing size of a free block matter; the
+	// whole pages between them need neither frames nor store space
+	vh_discard((unsigned)b + sizeof(vhblk_t), (unsigned)n - sizeof(unsigned));
+
 	restore(ps);
 	return(OK);
 }
@@ -9,63 +9,82 @@
 extern struct pentry proctab[];
 /*------------------------------------------------------------------------
  * vgetmem - allocate virtual heap storage, returning lowest WORD address
+ *
+ * The head of the request's size class is taken if it fits; otherwise
+ * any block of a larger class does, and the lowest nonempty one is found
+ * with one bsf on the class bitmap.  With no free block big enough the
+ * block is carved from the untouched top of the heap.
  *------------------------------------------------------------------------
  */
 WORD	*vgetmem(nbytes)
 	unsigned nbytes;
 {
-	STATWORD ps;    
-	struct	mblock	*p, *q, *leftover;
+	STATWORD ps;
 	struct	pentry	*pptr;
+	vheap_t	*vh;
+	vhblk_t	*b, *r;
+	unsigned long	mask;
+	unsigned	need, len;
+	int	c;
 
 	disable(ps);
-	
+
 	// Get current process entry
 	pptr = &proctab[currpid];
-	
+	vh = &vh_tab[currpid];
+
 	// Check if process has a virtual heap (created with vcreate)
 	if (pptr->vmemlist == NULL) {
 		restore(ps);
 		return( (WORD *)SYSERR );
 	}
-	
-	if (nbytes == 0) {
+
+	if (nbytes == 0 || nbytes > vh->vh_end - vh->vh_base) {
 		restore(ps);
 		return( (WORD *)SYSERR );
 	}
-	
-	nbytes = (unsigned int) roundmb(nbytes);
-	
-	// Search for a free block in the virtual heap
-	for (q = pptr->vmemlist, p = pptr->vmemlist->mnext;
-	     p != (struct mblock *) NULL;
-	     q = p, p = p->mnext) {
-		if (p->mlen == nbytes) {
-			// Exact match - remove the block
-			q->mnext = p->mnext;
-			restore(ps);
-			return( (WORD *)p );
-		} else if (p->mlen > nbytes) {
-			// Split the block only if leftover is large enough for an mblock header
-			unsigned leftover_size = p->mlen - nbytes;
-			if (leftover_size < sizeof(struct mblock)) {
-				// Leftover too small, give whole block
-				q->mnext = p->mnext;
-				restore(ps);
-				return( (WORD *)p );
-			}
-			// Split the block
-			leftover = (struct mblock *)( (unsigned)p + nbytes );
-			q->mnext = leftover;
-			leftover->mnext = p->mnext;
-			leftover->mlen = leftover_size;
+
+	need = (unsigned int) roundmb(nbytes) + VB_HDR;
+	if (need < VB_MIN) {
+		need = VB_MIN;
+	}
+
+	c = vh_class(need);
+	b = vh->vh_free[c];
+	if (b == NULL || vb_len(b) < need) {
+		mask = c + 1 < VH_NCLASS ? vh->vh_bins & ~((2UL << c) - 1) : 0;
+		b = NULL;
+		if (mask != 0) {
+			__asm__ ("bsfl %1, %0" : "=r"(c) : "rm"(mask));
+			b = vh->vh_free[c];
+		}
+	}
+
+	if (b != NULL) {
+		vh_unlink(vh, b);
+		len = vb_len(b);
+		if (len - need >= VB_MIN) {
+			// Split; the tail stays free and keeps b's end
+			r = (vhblk_t *)((unsigned)b + need);
+			vh_link(vh, r, len - need);
+			len = need;
+		} else {
+			// The block after the whole of b is no longer preceded
+			// by a free one
+			r = (vhblk_t *)((unsigned)b + len);
+			r->vb_size &= ~VB_PFREE;
+		}
+	} else {
+		if (vh->vh_end - vh->vh_top < need) {
 			restore(ps);
-			return( (WORD *)p );
+			return( (WORD *)SYSERR );
 		}
+		b = (vhblk_t *)vh->vh_top;
+		vh->vh_top += need;
+		len = need;
 	}
-	
+
+	b->vb_size = len | VB_INUSE;
 	restore(ps);
-	return( (WORD *)SYSERR );
+	return( (WORD *)((unsigned)b + VB_HDR) );
 }
-
-
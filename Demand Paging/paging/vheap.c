@@ -0,0 +1,84 @@
+/* vheap.c - vh_init, vh_link, vh_unlink: virtual heap free lists */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* Each virtual heap is carved into blocks that start with a header word
+ * holding the block size and the VB_INUSE/VB_PFREE flags.  A free block
+ * also carries its list links and repeats its size in its last word, so
+ * vfreemem() can find and merge both neighbours without walking
+ * anything.  The free lists are segregated by power-of-two size class
+ * and their heads live here in kernel memory, so picking a block only
+ * touches that block.  Space above vh_top has never been handed out
+ * and holds no tags at all; it is only faulted in as it is allocated.
+ */
+vheap_t vh_tab[NPROC];
+
+/*-------------------------------------------------------------------------
+ * vh_init - make pid's heap at vpno one untouched run of npages pages
+ *-------------------------------------------------------------------------
+ */
+void vh_init(int pid, int vpno, int npages)
+{
+  vheap_t *vh = &vh_tab[pid];
+  int c;
+
+  vh->vh_base = vh->vh_top = (unsigned long)vpno * NBPG;
+  vh->vh_end = vh->vh_base + (unsigned long)npages * NBPG;
+  vh->vh_bins = 0;
+  for (c = 0; c < VH_NCLASS; c++) {
+    vh->vh_free[c] = NULL;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * vh_class - return the free list for blocks of len bytes
+ *-------------------------------------------------------------------------
+ */
+int vh_class(unsigned len)
+{
+  int bit;
+
+  __asm__ ("bsrl %1, %0" : "=r"(bit) : "rm"(len));
+  bit -= VH_SHIFT;
+  return bit < VH_NCLASS ? bit : VH_NCLASS - 1;
+}
+
+/*-------------------------------------------------------------------------
+ * vh_link - tag free block b with its size and push it on its list
+ *-------------------------------------------------------------------------
+ */
+void vh_link(vheap_t *vh, vhblk_t *b, unsigned len)
+{
+  int c = vh_class(len);
+
+  b->vb_size = len;
+  vb_foot(b, len) = len;
+  b->vb_prev = NULL;
+  b->vb_next = vh->vh_free[c];
+  if (b->vb_next != NULL) {
+    b->vb_next->vb_prev = b;
+  }
+  vh->vh_free[c] = b;
+  vh->vh_bins |= 1UL << c;
+}
+
+/*-------------------------------------------------------------------------
+ * vh_unlink - take free block b off its list
+ *-------------------------------------------------------------------------
+ */
+void vh_unlink(vheap_t *vh, vhblk_t *b)
+{
+  int c = vh_class(vb_len(b));
+
+  if (b->vb_prev != NULL) {
+    b->vb_prev->vb_next = b->vb_next;
+  } else if ((vh->vh_free[c] = b->vb_next) == NULL) {
+    vh->vh_bins &= ~(1UL << c);
+  }
+  if (b->vb_next != NULL) {
+    b->vb_next->vb_prev = b->vb_prev;
+  }
+}
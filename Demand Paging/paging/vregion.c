@@ -0,0 +1,146 @@
+/* vregion.c - per-process virtual region index */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* One sorted interval array per process, shared by the fault, eviction
+ * and writeback paths so that none of them has to scan bsm_tab or
+ * xmmap_tab to translate a vpno into (store, pageth).
+ */
+vindex_t vr_tab[NPROC];
+
+/*-------------------------------------------------------------------------
+ * init_vregion - empty every process's region index
+ *-------------------------------------------------------------------------
+ */
+SYSCALL init_vregion()
+{
+  int i;
+  for (i = 0; i < NPROC; i++) {
+    vr_tab[i].vi_count = 0;
+  }
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * vr_search - binary search for the last region starting at or below vpno
+ *
+ * Returns the slot index, or -1 if every region starts above vpno.
+ *-------------------------------------------------------------------------
+ */
+static int vr_search(vindex_t *vi, int vpno)
+{
+  int lo = 0;
+  int hi = vi->vi_count - 1;
+  int found = -1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) >> 1;
+    if (vi->vi_reg[mid].vr_vpno <= vpno) {
+      found = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return found;
+}
+
+/*-------------------------------------------------------------------------
+ * vr_lookup - find the region of pid that contains vpno
+ *
+ * Returns a pointer into vr_tab, or NULL if vpno is not mapped.
+ *-------------------------------------------------------------------------
+ */
+vregion_t *vr_lookup(int pid, int vpno)
+{
+  vindex_t *vi;
+  vregion_t *vr;
+  int slot;
+
+  if (pid < 0 || pid >= NPROC) {
+    return NULL;
+  }
+  vi = &vr_tab[pid];
+  slot = vr_search(vi, vpno);
+  if (slot < 0) {
+    return NULL;
+  }
+  vr = &vi->vi_reg[slot];
+  if (vpno >= vr->vr_vpno + vr->vr_npages) {
+    return NULL;
+  }
+  return vr;
+}
+
+/*-------------------------------------------------------------------------
+ * vr_insert - add [vpno, vpno + npages) to pid's index
+ *
+ * Regions of a process may not overlap; returns SYSERR if the new range
+ * intersects an existing one or the index is full.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL vr_insert(int pid, int vpno, int npages, int bs_id, int type, int xm_idx)
+{
+  vindex_t *vi;
+  int slot, i;
+
+  if (pid < 0 || pid >= NPROC || npages <= 0) {
+    return SYSERR;
+  }
+  vi = &vr_tab[pid];
+  if (vi->vi_count >= NVREGIONS) {
+    return SYSERR;
+  }
+
+  slot = vr_search(vi, vpno);
+  // The predecessor must end before us and the successor start after us
+  if (slot >= 0 &&
+      vi->vi_reg[slot].vr_vpno + vi->vi_reg[slot].vr_npages > vpno) {
+    return SYSERR;
+  }
+  if (slot + 1 < vi->vi_count &&
+      vi->vi_reg[slot + 1].vr_vpno < vpno + npages) {
+    return SYSERR;
+  }
+
+  for (i = vi->vi_count; i > slot + 1; i--) {
+    vi->vi_reg[i] = vi->vi_reg[i - 1];
+  }
+  vi->vi_reg[slot + 1].vr_vpno = vpno;
+  vi->vi_reg[slot + 1].vr_npages = npages;
+  vi->vi_reg[slot + 1].vr_bs_id = bs_id;
+  vi->vi_reg[slot + 1].vr_type = type;
+  vi->vi_reg[slot + 1].vr_xm_idx = xm_idx;
+  vi->vi_reg[slot + 1].vr_ra_next = -1;
+  vi->vi_reg[slot + 1].vr_ra_win = 0;
+  vi->vi_reg[slot + 1].vr_advice = XM_NORMAL;
+  vi->vi_count++;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * vr_remove - drop the region of pid that starts exactly at vpno
+ *-------------------------------------------------------------------------
+ */
+SYSCALL vr_remove(int pid, int vpno)
+{
+  vindex_t *vi;
+  int slot, i;
+
+  if (pid < 0 || pid >= NPROC) {
+    return SYSERR;
+  }
+  vi = &vr_tab[pid];
+  slot = vr_search(vi, vpno);
+  if (slot < 0 || vi->vi_reg[slot].vr_vpno != vpno) {
+    return SYSERR;
+  }
+  for (i = slot; i < vi->vi_count - 1; i++) {
+    vi->vi_reg[i] = vi->vi_reg[i + 1];
+  }
+  vi->vi_count--;
+  return OK;
+}
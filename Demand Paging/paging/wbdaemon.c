@@ -0,0 +1,109 @@
+/* wbdaemon.c - init_wbd, wbdaemon, wb_kick */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <q.h>
+#include <sem.h>
+#include <paging.h>
+
+int wb_sem = SYSERR;			/* daemon waits here for work	*/
+int wb_pid = SYSERR;			/* writeback daemon process id	*/
+unsigned long wb_nasync = 0;		/* dirty pages cleaned ahead	*/
+unsigned long wb_nsync = 0;		/* dirty pages cleaned on evict	*/
+
+static int wb_hand = 0;			/* next frame the daemon looks at */
+
+LOCAL PROCESS wbdaemon();
+
+/*-------------------------------------------------------------------------
+ * init_wbd - start the dirty-page writeback daemon
+ *-------------------------------------------------------------------------
+ */
+SYSCALL init_wbd()
+{
+  if ((wb_sem = screate(0)) == SYSERR) {
+    return SYSERR;
+  }
+  wb_pid = create(wbdaemon, WB_STK, WB_PRIO, "wbdaemon", 0, NULL);
+  if (wb_pid == SYSERR) {
+    return SYSERR;
+  }
+  numproc--;		/* a kernel daemon does not keep Xinu alive */
+
+  // Only kernel memory is touched, so run in the null process's address
+  // space and give back the page directory create() allocated
+  free_frm((int)(proctab[wb_pid].pdbr / NBPG) - FRAME0);
+  proctab[wb_pid].pdbr = proctab[NULLPROC].pdbr;
+  resume(wb_pid);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * wb_kick - wake the daemon if it is idle; safe inside pfint because it
+ * never reschedules, the daemon runs at the next preemption instead
+ *-------------------------------------------------------------------------
+ */
+void wb_kick(void)
+{
+  struct sentry *sptr;
+
+  if (wb_sem == SYSERR) {
+    return;
+  }
+  sptr = &semaph[wb_sem];
+  if (sptr->semcnt < 0) {
+    sptr->semcnt++;
+    ready(getfirst(sptr->sqhead), RESCHNO);
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * wb_clean - write back cold dirty pages until free frames plus clean
+ * cold frames reach WB_HIWAT or every frame has been looked at once
+ *-------------------------------------------------------------------------
+ */
+LOCAL void wb_clean(void)
+{
+  STATWORD ps;
+  int n, i, ready_cnt;
+  pt_t *pte;
+
+  ready_cnt = frm_nfree;
+  for (n = 0; n < NFRAMES && ready_cnt < WB_HIWAT; n++) {
+    // One page per critical section so faulting processes are not held up
+    disable(ps);
+    i = wb_hand;
+    wb_hand = (wb_hand + 1) % NFRAMES;
+    pte = frm_pte(i);
+    if (pte != NULL && !pte->pt_acc) {
+      if (pte->pt_dirty || frm_tab[i].fr_dirty) {
+        if (frm_writeback(i) == OK) {
+          wb_nasync++;
+          ready_cnt++;
+        }
+      } else {
+        ready_cnt++;
+      }
+    }
+    restore(ps);
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * wbdaemon - clean frames ahead of eviction and refill the free pool
+ * whenever the free pool crosses WB_HIWAT or drops below WB_LOWAT;
+ * processes that asked to hear about memory pressure are told first, so
+ * they can give pages back before the policy takes them
+ *-------------------------------------------------------------------------
+ */
+LOCAL PROCESS wbdaemon()
+{
+  while (TRUE) {
+    wait(wb_sem);
+    pp_update();
+    wb_clean();
+    frm_reclaim();
+  }
+  return OK;
+}
@@ -12,13 +12,15 @@
  */
 SYSCALL write_bs(char *src, bsd_t bs_id, int page) {
 
+  char *phy_addr;
+
   // Check illegal bs_id
-  if (bs_id < 0 || bs_id > 7) {
+  if (bs_id < 0 || bs_id >= MAX_BS) {
     return SYSERR;
   }
 
   // Check illegal page
-  if (page < 0 || page > 255) {
+  if (page < 0 || page >= BS_MAXPAGES) {
     return SYSERR;
   }
 
@@ -27,10 +29,155 @@ SYSCALL write_bs(char *src, bsd_t bs_id, int page) {
     return SYSERR;
   }
 
-  char *phy_addr = (char *)(BACKING_STORE_BASE + bs_id * BACKING_STORE_UNIT_SIZE + page * NBPG);
+  // Zero, same-filled and compressible pages stay out of the pool
+  zs_forget(bs_id, page);
+  if (zs_store(src, bs_id, page) == OK) {
+    return OK;
+  }
 
-  bcopy((void *)src, (void *)phy_addr, NBPG);
+  // The first write to a run of pages takes space for it from the pool
+  if ((phy_addr = bs_alloc(bs_id, page)) == NULL) {
+    return SYSERR;
+  }
+
+  pg_copy(phy_addr, src, 1);
+  bs_mark_written(bs_id, page);
+
+  return OK;
+}
+
+
+/*-------------------------------------------------------------------------
+ * bsv_check - validate every (page, frame) pair of a vectored request
+ *-------------------------------------------------------------------------
+ */
+SYSCALL bsv_check(bsvec_t *vec, int n)
+{
+  int k;
 
+  for (k = 0; k < n; k++) {
+    if (vec[k].bv_page < 0 || vec[k].bv_page >= BS_MAXPAGES ||
+        vec[k].bv_frm < 0 || vec[k].bv_frm >= NFRAMES) {
+      return SYSERR;
+    }
+  }
   return OK;
 }
 
+/*-------------------------------------------------------------------------
+ * bsv_run - length of the run at vec[0] that is contiguous in the store,
+ * in the pool space behind store bs_id and in physical memory
+ *-------------------------------------------------------------------------
+ */
+int bsv_run(bsd_t bs_id, bsvec_t *vec, int n)
+{
+  int run;
+  char *base = bs_addr(bs_id, vec[0].bv_page);
+
+  for (run = 1; run < n; run++) {
+    if (vec[run].bv_page != vec[0].bv_page + run ||
+        vec[run].bv_frm != vec[0].bv_frm + run ||
+        bs_addr(bs_id, vec[run].bv_page) != base + run * NBPG) {
+      break;
+    }
+  }
+  return run;
+}
+
+/*-------------------------------------------------------------------------
+ * bsv_write - copy n frames into their pages of the store pool
+ *-------------------------------------------------------------------------
+ */
+static SYSCALL bsv_write(bsd_t bs_id, bsvec_t *vec, int n)
+{
+  int k, run;
+
+  // Take space for every page first, so a full pool writes nothing
+  for (k = 0; k < n; k++) {
+    if (bs_alloc(bs_id, vec[k].bv_page) == NULL) {
+      return SYSERR;
+    }
+  }
+  for (k = 0; k < n; k += run) {
+    run = bsv_run(bs_id, vec + k, n - k);
+    pg_copy(bs_addr(bs_id, vec[k].bv_page),
+            (void *)((FRAME0 + vec[k].bv_frm) * NBPG), run);
+  }
+  for (k = 0; k < n; k++) {
+    bs_mark_written(bs_id, vec[k].bv_page);
+  }
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * write_bs_v - write n frames to backing store bs_id; vec[k] names the
+ * frm_tab index and the store page it goes to.  Pages the compressed
+ * tier does not keep go to the pool, where runs that are contiguous both
+ * in memory and in the store are moved with one pg_copy.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL write_bs_v(bsd_t bs_id, bsvec_t *vec, int n)
+{
+  bsvec_t rest[BS_NVEC];
+  int k, m;
+
+  if (bs_id < 0 || bs_id >= MAX_BS || vec == NULL || n < 0 ||
+      bsv_check(vec, n) == SYSERR) {
+    return SYSERR;
+  }
+
+  for (k = m = 0; k < n; k++) {
+    zs_forget(bs_id, vec[k].bv_page);
+    if (zs_store((char *)((FRAME0 + vec[k].bv_frm) * NBPG), bs_id,
+                 vec[k].bv_page) == OK) {
+      continue;
+    }
+    rest[m++] = vec[k];
+    if (m == BS_NVEC) {
+      if (bsv_write(bs_id, rest, m) == SYSERR) {
+        return SYSERR;
+      }
+      m = 0;
+    }
+  }
+  return m > 0 ? bsv_write(bs_id, rest, m) : OK;
+}
+
+/*-------------------------------------------------------------------------
+ * copy_bs - copy the first npages pages of backing store src to dst
+ *-------------------------------------------------------------------------
+ */
+SYSCALL copy_bs(bsd_t dst, bsd_t src, int npages)
+{
+  int k;
+  char *to;
+
+  if (dst < 0 || dst >= MAX_BS || src < 0 || src >= MAX_BS ||
+      npages < 0 || npages > BS_MAXPAGES) {
+    return SYSERR;
+  }
+
+  // Only written pages take space; the rest read back as zeroes.  Pages
+  // in the compressed tier are copied compressed when there is room.
+  for (k = 0; k < npages; k++) {
+    zs_forget(dst, k);
+    if (bs_zipped(src, k)) {
+      if (zs_copy(dst, src, k) == SYSERR) {
+        if ((to = bs_alloc(dst, k)) == NULL) {
+          return SYSERR;
+        }
+        zs_load(to, src, k);
+        bs_mark_written(dst, k);
+      }
+    } else if (bs_written(src, k)) {
+      if ((to = bs_alloc(dst, k)) == NULL) {
+        return SYSERR;
+      }
+      pg_copy(to, bs_addr(src, k), 1);
+      bs_mark_written(dst, k);
+    } else {
+      bsm_tab[dst].bs_wmap[k >> 5] &= ~(1UL << (k & 31));
+    }
+  }
+  return OK;
+}
@@ -8,13 +8,15 @@
 
 /*-------------------------------------------------------------------------
  * xmmap - map the virtual page to the backing store source with a 
- * permitted access range of npages (<= 256) for the calling process.
+ * permitted access range of npages (<= BS_MAXPAGES) for the calling process.
+ * The range may not overlap another mapping of the calling process.
  * 
  * Return OK if the call succeeded and SYSERR if it failed for any reason.
  *-------------------------------------------------------------------------
  */
 SYSCALL xmmap(int virtpage, bsd_t source, int npages)
 {
+  STATWORD ps;
   int i;
   int bs_id = (int)source;
   
@@ -25,7 +27,10 @@ SYSCALL xmmap(int virtpage, bsd_t source, int npages)
   if (bs_id < 0 || bs_id >= MAX_BS) {
     return SYSERR;
   }
-  if (npages <= 0 || npages > 256) {
+  if (npages <= 0 || npages > BS_MAXPAGES) {
+    return SYSERR;
+  }
+  if (virtpage < stk_slot(NPROC) && virtpage + npages > STK_VPNO) {
     return SYSERR;
   }
 
@@ -35,21 +40,31 @@ SYSCALL xmmap(int virtpage, bsd_t source, int npages)
     return SYSERR;
   }
 
-  // Check if this process already has an xmmap mapping for this virtpage
-  for (i = 0; i < xmmap_count; i++) {
-    if (xmmap_tab[i].xm_pid == currpid && xmmap_tab[i].xm_vpno == virtpage) {
-      return SYSERR;
-    }
-  }
-
   // Find free slot in xmmap_tab
+  disable(ps);
   for (i = 0; i < MAX_XMMAP_ENTRIES; i++) {
     if (xmmap_tab[i].xm_pid == -1) {
+      // Every page of the range needs store space to be evicted to
+      if (bs_reserve(bs_id, npages) == SYSERR) {
+        restore(ps);
+        return SYSERR;
+      }
+      // Index the range first; this rejects ranges that overlap an
+      // existing heap or xmmap region of this process
+      if (vr_insert(currpid, virtpage, npages, bs_id, BS_TYPE_XMMAP, i) == SYSERR) {
+        if (bsm_tab[bs_id].bs_status == BSM_UNMAPPED) {
+          bs_unreserve(bs_id);
+        }
+        restore(ps);
+        return SYSERR;
+      }
+
       // Add xmmap entry
       xmmap_tab[i].xm_pid = currpid;
       xmmap_tab[i].xm_vpno = virtpage;
       xmmap_tab[i].xm_npages = npages;
       xmmap_tab[i].xm_bs_id = bs_id;
+      xm_link(i);
       
       if (i >= xmmap_count) {
         xmmap_count = i + 1;
@@ -61,16 +76,50 @@ SYSCALL xmmap(int virtpage, bsd_t source, int npages)
         bsm_tab[bs_id].bs_type = BS_TYPE_XMMAP;
         bsm_tab[bs_id].bs_pid = BS_XMMAP_PID;  
       }
+      restore(ps);
       return OK;
     }
   }
   
   // No free slot in xmmap_tab
+  restore(ps);
   return SYSERR;
 }
 
 
 
+/*-------------------------------------------------------------------------
+ * xm_flush - write n gathered dirty pages of the mapping at start_vpno to
+ * store and mark them clean; the shared store page is what other
+ * processes mapping the same store will read from
+ *-------------------------------------------------------------------------
+ */
+static void xm_flush(pd_t *pd, int start_vpno, int store, bsvec_t *vec, int n)
+{
+  int k;
+  unsigned long page_vaddr;
+  pt_t *pt;
+
+  if (n == 0) {
+    return;
+  }
+  if (write_bs_v((bsd_t)store, vec, n) == SYSERR) {
+    kprintf("xmunmap: Failed to write %d dirty pages to BS %d from page %d\n",
+            n, store, vec[0].bv_page);
+    return;
+  }
+  pg_paged_out(currpid, n);
+  tr_event(TR_WB, currpid, start_vpno + vec[0].bv_page, n);
+  for (k = 0; k < n; k++) {
+    page_vaddr = (unsigned long)(start_vpno + vec[k].bv_page) << 12;
+    pt = (pt_t *)(pd[(page_vaddr >> 22) & 0x3FF].pd_base << 12);
+    pt[(page_vaddr >> 12) & 0x3FF].pt_dirty = 0;
+    if (frm_tab[vec[k].bv_frm].fr_status == FRM_MAPPED) {
+      frm_tab[vec[k].bv_frm].fr_dirty = 0;
+    }
+  }
+}
+
 /*-------------------------------------------------------------------------
  * xmunmap - free the xmmapping corresponding to virtpage for the calling 
  * process.
@@ -84,9 +133,6 @@ SYSCALL xmmap(int virtpage, bsd_t source, int npages)
  */
 SYSCALL xmunmap(int virtpage)
 {
-  unsigned long vaddr;
-  int store, pageth;
-  int i;
   unsigned long vpno;
   unsigned long start_vpno, end_vpno;
   pd_t *pd;
@@ -94,48 +140,40 @@ SYSCALL xmunmap(int virtpage)
   unsigned int pd_idx, pt_idx;
   unsigned long page_vaddr;
   int frm_idx;
-  unsigned long page_phys_addr;
+  bsvec_t vec[BS_NVEC];
+  int n;
+  tlbbatch_t tb;
   
   if (virtpage < 4096) {
     return SYSERR;
   }
   
-  // Find the full mapping info (start vpno and npages) from xmmap_tab
-  // IMPORTANT: We check xmmap_tab directly instead of using bsm_lookup
-  // because bsm_lookup prioritizes VHEAP mappings, which could return
-  // the wrong mapping if a process has both VHEAP and xmmap that overlap
-  start_vpno = 0;
-  int npages = 0;
-  int xmmap_idx = -1;
-  int xmmap_bs_id = -1;
-  
-  // Search in xmmap_tab for this process's mapping
-  for (i = 0; i < xmmap_count; i++) {
-    if (xmmap_tab[i].xm_pid == currpid && 
-        (int)virtpage >= xmmap_tab[i].xm_vpno && 
-        (int)virtpage < xmmap_tab[i].xm_vpno + xmmap_tab[i].xm_npages) {
-      start_vpno = xmmap_tab[i].xm_vpno;
-      npages = xmmap_tab[i].xm_npages;
-      xmmap_bs_id = xmmap_tab[i].xm_bs_id;
-      xmmap_idx = i;
-      break;
-    }
-  }
-  
-  if (npages == 0 || xmmap_idx == -1 || xmmap_bs_id < 0) {
+  // Find the full mapping info (start vpno and npages) from the region
+  // index; a VHEAP region covering virtpage is not ours to unmap
+  vregion_t *vr = vr_lookup(currpid, virtpage);
+  if (vr == NULL || vr->vr_type != BS_TYPE_XMMAP) {
     return SYSERR;  // Mapping not found
   }
+  start_vpno = vr->vr_vpno;
+  int npages = vr->vr_npages;
+  int xmmap_idx = vr->vr_xm_idx;
+  int xmmap_bs_id = vr->vr_bs_id;
   
   end_vpno = start_vpno + npages;
   
   // Get page directory
   pd = (pd_t *) proctab[currpid].pdbr;
   
+  // Locks on the range end with the mapping
+  xm_unlock_range(currpid, start_vpno, npages);
+  
   // Iterate through all pages in the mapping range
   // For shared backing stores (xmmap), each process maps to the same backing store pages
   // Example: Process A maps vpage 4100->BS page 0, Process B maps vpage 4200->BS page 0
-  // When Process A writes back, we calculate pageth = vpno - start_vpno directly
-  // from the xmmap_tab entry (not using bsm_lookup which might return VHEAP mapping)
+  // When Process A writes back, pageth = vpno - start_vpno comes directly
+  // from the region (not using bsm_lookup which might return VHEAP mapping)
+  // Dirty pages are gathered and written BS_NVEC at a time
+  n = 0;
   for (vpno = start_vpno; vpno < end_vpno; vpno++) {
     page_vaddr = vpno << 12;
     pd_idx = (page_vaddr >> 22) & 0x3FF;
@@ -151,58 +189,82 @@ SYSCALL xmunmap(int virtpage)
         frm_idx = (int)pt[pt_idx].pt_base - FRAME0;
         
         if (frm_idx >= 0 && frm_idx < NFRAMES) {
-          // Get physical address of the frame
-          page_phys_addr = (FRAME0 + frm_idx) * NBPG;
-          
-          // Calculate backing store page number directly from xmmap mapping
-          store = xmmap_bs_id;
-          pageth = (int)vpno - start_vpno;
-          
-          // Write dirty page back to backing store
-          // For shared backing stores, this write updates the shared BS page
-          // that other processes mapping the same BS will read from
-          if (write_bs((char *)page_phys_addr, (bsd_t)store, pageth) == SYSERR) {
-            kprintf("xmunmap: Failed to write dirty page vpno %d to BS %d page %d\n", 
-                    (int)vpno, store, pageth);
-            // Continue with other pages even if one fails
-          } else {
-            // Clear dirty bit after successful write
-            pt[pt_idx].pt_dirty = 0;
-            if (frm_tab[frm_idx].fr_status == FRM_MAPPED) {
-              frm_tab[frm_idx].fr_dirty = 0;
-            }
+          vec[n].bv_page = (int)vpno - start_vpno;
+          vec[n].bv_frm = frm_idx;
+          if (++n == BS_NVEC) {
+            xm_flush(pd, start_vpno, xmmap_bs_id, vec, n);
+            n = 0;
           }
         }
       }
     }
   }
+  xm_flush(pd, start_vpno, xmmap_bs_id, vec, n);
   
-  // Now unmap the mapping - remove from xmmap_tab
-  if (xmmap_idx >= 0) {
-    // Clear the xmmap entry
-    xmmap_tab[xmmap_idx].xm_pid = -1;
-    xmmap_tab[xmmap_idx].xm_vpno = 0;
-    xmmap_tab[xmmap_idx].xm_npages = 0;
-    xmmap_tab[xmmap_idx].xm_bs_id = -1;
-    
-    // Check if this was the last xmmap for this backing store
-    int has_other_xmmaps = 0;
-    for (i = 0; i < xmmap_count; i++) {
-      if (xmmap_tab[i].xm_bs_id == xmmap_bs_id && xmmap_tab[i].xm_pid != -1) {
-        has_other_xmmaps = 1;
-        break;
-      }
+  // Drop the now clean resident pages so nothing maps the range any more
+  tlb_begin(&tb);
+  for (vpno = start_vpno; vpno < end_vpno; vpno++) {
+    page_vaddr = vpno << 12;
+    pd_idx = (page_vaddr >> 22) & 0x3FF;
+    pt_idx = (page_vaddr >> 12) & 0x3FF;
+    if (!pd[pd_idx].pd_pres) {
+      continue;
     }
-    
-    // If no other xmmaps use this backing store, mark it as unmapped
-    if (!has_other_xmmaps) {
-      bsm_tab[xmmap_bs_id].bs_status = BSM_UNMAPPED;
-      bsm_tab[xmmap_bs_id].bs_type = BS_TYPE_VHEAP;
-      bsm_tab[xmmap_bs_id].bs_pid = -1;
+    pt = (pt_t *)(pd[pd_idx].pd_base << 12);
+    if (!pt[pt_idx].pt_pres) {
+      continue;
     }
-    
-    return OK;
+    frm_idx = (int)pt[pt_idx].pt_base - FRAME0;
+    pt[pt_idx].pt_pres = 0;
+    tlb_add(&tb, currpid, page_vaddr);
+    // Other mappers of the store keep using the cached frame
+    if (frm_idx >= 0 && frm_idx < NFRAMES) {
+      if (frm_tab[frm_idx].fr_bs != -1) {
+        pc_drop(frm_idx, currpid, 0);
+      } else if (frm_tab[frm_idx].fr_pid == currpid) {
+        free_frm(frm_idx);
+      }
+    }
+    pt_unref(pd, pd_idx);
   }
+  tlb_flush(&tb);
   
-  return SYSERR;
+  // Now unmap the mapping - remove from xmmap_tab
+  return xm_release(xmmap_idx);
+}
+
+/*-------------------------------------------------------------------------
+ * xm_release - drop xmmap_tab entry idx from its owner's region index and
+ * its store's mapper chain, and free the store once nobody maps it.
+ *
+ * Dirty pages must already have been written back by the caller.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xm_release(int idx)
+{
+  int bs_id;
+
+  if (idx < 0 || idx >= MAX_XMMAP_ENTRIES || xmmap_tab[idx].xm_pid == -1) {
+    return SYSERR;
+  }
+  bs_id = xmmap_tab[idx].xm_bs_id;
+
+  vr_remove(xmmap_tab[idx].xm_pid, xmmap_tab[idx].xm_vpno);
+  xm_unlink(idx);
+
+  // Clear the xmmap entry
+  xmmap_tab[idx].xm_pid = -1;
+  xmmap_tab[idx].xm_vpno = 0;
+  xmmap_tab[idx].xm_npages = 0;
+  xmmap_tab[idx].xm_bs_id = -1;
+
+  // If no other xmmaps use this backing store, mark it as unmapped; it
+  // keeps its contents but no room to grow
+  if (bsm_tab[bs_id].bs_xmhead == -1) {
+    bs_unreserve(bs_id);
+    bsm_tab[bs_id].bs_status = BSM_UNMAPPED;
+    bsm_tab[bs_id].bs_type = BS_TYPE_VHEAP;
+    bsm_tab[bs_id].bs_pid = -1;
+  }
+  return OK;
 }
@@ -0,0 +1,137 @@
+/* xmadvise.c - xmadvise, xm_discard, vh_discard */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* Hints about how a process will use a range of its heap or xmmap
+ * regions.  XM_SEQUENTIAL and XM_RANDOM stay with the whole region the
+ * pages are in and steer pf_readahead(); XM_NORMAL puts the default
+ * back.  XM_WILLNEED and XM_DONTNEED act on the pages at once.
+ */
+unsigned long xm_ndiscard = 0;		/* frames dropped unwritten	*/
+
+/*-------------------------------------------------------------------------
+ * xm_discard - drop pages vpno to vpno+n-1 of currpid's region vr
+ *
+ * A private page loses its frame and whatever the store holds for it,
+ * so it is zero-filled on the next touch; a frame still shared after
+ * vfork() just loses this process's reference.  An xmmap page belongs
+ * to every mapper of the store, so it is only unmapped here and keeps
+ * its contents.  Locked pages are left alone.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xm_discard(vregion_t *vr, int vpno, int n)
+{
+  pd_t *pd = (pd_t *)proctab[currpid].pdbr;
+  pt_t *pt;
+  tlbbatch_t tb;
+  int v, f, pd_idx, pageth, dirty;
+
+  tlb_begin(&tb);
+  for (v = vpno; v < vpno + n; v++) {
+    pd_idx = (v >> 10) & 0x3FF;
+    pt = (pt_t *)(pd[pd_idx].pd_base << 12);
+    if (pd[pd_idx].pd_pres && pt[v & 0x3FF].pt_pres) {
+      // A locked page keeps its frame and its contents
+      if (pt[v & 0x3FF].pt_avail & PT_LOCK) {
+        continue;
+      }
+      // A table shared after vfork() is copied before an entry changes
+      if ((pt = pt_unshare(pd, pd_idx)) == NULL) {
+        tlb_flush(&tb);
+        return SYSERR;
+      }
+      pt = &pt[v & 0x3FF];
+      f = (int)pt->pt_base - FRAME0;
+      dirty = pt->pt_dirty;
+      pt->pt_pres = 0;
+      tlb_add(&tb, currpid, (unsigned long)v << 12);
+      pt_unref(pd, pd_idx);
+
+      if (vr->vr_type == BS_TYPE_XMMAP) {
+        pc_drop(f, currpid, dirty);
+      } else if (frm_tab[f].fr_refcnt > 1) {
+        cow_drop(f, currpid);
+      } else {
+        free_frm(f);
+      }
+      xm_ndiscard++;
+    }
+
+    if (vr->vr_type != BS_TYPE_XMMAP) {
+      pageth = v - vr->vr_vpno;
+      zs_forget(vr->vr_bs_id, pageth);
+      bsm_tab[vr->vr_bs_id].bs_wmap[pageth >> 5] &= ~(1UL << (pageth & 31));
+    }
+  }
+  tlb_flush(&tb);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * xmadvise - tell the kernel how the npages pages at vaddr will be used
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xmadvise(unsigned long vaddr, int npages, int hint)
+{
+  STATWORD ps;
+  vregion_t *vr;
+  int v, k, n, end, rc = OK;
+
+  if ((vaddr & (NBPG - 1)) != 0 || npages <= 0 ||
+      hint < XM_NORMAL || hint > XM_DONTNEED) {
+    return SYSERR;
+  }
+  end = (int)(vaddr >> 12) + npages;
+
+  disable(ps);
+  // Every page of the range has to be mapped before anything is done
+  for (v = (int)(vaddr >> 12); v < end; v += n) {
+    if ((vr = vr_lookup(currpid, v)) == NULL) {
+      restore(ps);
+      return SYSERR;
+    }
+    n = min(end, vr->vr_vpno + vr->vr_npages) - v;
+  }
+
+  for (v = (int)(vaddr >> 12); v < end; v += n) {
+    vr = vr_lookup(currpid, v);
+    n = min(end, vr->vr_vpno + vr->vr_npages) - v;
+    switch (hint) {
+    case XM_WILLNEED:
+      // Only a hint: stop quietly once memory is too tight
+      for (k = 0; k < n && pf_prefetch(vr, v + k) == OK; k++)
+        ;
+      break;
+    case XM_DONTNEED:
+      if (xm_discard(vr, v, n) == SYSERR) {
+        rc = SYSERR;
+      }
+      break;
+    default:
+      vr->vr_advice = hint;
+      vr->vr_ra_win = 0;
+      break;
+    }
+  }
+  restore(ps);
+  return rc;
+}
+
+/*-------------------------------------------------------------------------
+ * vh_discard - the heap bytes from lo up to hi hold nothing; drop the
+ * whole pages among them
+ *-------------------------------------------------------------------------
+ */
+void vh_discard(unsigned long lo, unsigned long hi)
+{
+  vregion_t *vr;
+  int first = (int)((lo + NBPG - 1) >> 12);
+  int last = (int)(hi >> 12);
+
+  if (last > first && (vr = vr_lookup(currpid, first)) != NULL) {
+    xm_discard(vr, first, last - first);
+  }
+}
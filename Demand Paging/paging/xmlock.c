@@ -0,0 +1,145 @@
+/* xmlock.c - xmlock, xmunlock, xm_unlock_range, xm_unlock_all */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* A locked page stays resident until it is unlocked, unmapped or its
+ * process exits.  The PTE of each process that locked a page carries
+ * PT_LOCK, and the frame counts those PTEs in fr_pin; while fr_pin is
+ * nonzero the frame is off the replacement policy, so neither the
+ * policy, the reclaim pass nor a quota can pick it.  It stays charged
+ * to its owner's resident set.  A process may hold at most XM_LOCKLIM
+ * locked pages.
+ */
+
+/*-------------------------------------------------------------------------
+ * xm_lookup_pte - return the PTE of page vpno of pid, or NULL if the
+ * page is not present
+ *-------------------------------------------------------------------------
+ */
+static pt_t *xm_lookup_pte(int pid, int vpno)
+{
+  pd_t *pd = (pd_t *)proctab[pid].pdbr;
+  pt_t *pt;
+
+  if (pd == NULL || !pd[(vpno >> 10) & 0x3FF].pd_pres) {
+    return NULL;
+  }
+  pt = (pt_t *)(pd[(vpno >> 10) & 0x3FF].pd_base << 12);
+  return pt[vpno & 0x3FF].pt_pres ? &pt[vpno & 0x3FF] : NULL;
+}
+
+/*-------------------------------------------------------------------------
+ * xmlock - make the npages pages at vaddr resident and keep them so
+ *
+ * Pages are brought in as needed, evicting others to make room, and a
+ * copy-on-write page gets its private copy first so a later write does
+ * not move it.  Pages locked before a failure stay locked.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xmlock(unsigned long vaddr, int npages)
+{
+  STATWORD ps;
+  vregion_t *vr;
+  pt_t *pte;
+  int v, f, start, need;
+
+  if ((vaddr & (NBPG - 1)) != 0 || npages <= 0) {
+    return SYSERR;
+  }
+  start = (int)(vaddr >> 12);
+
+  disable(ps);
+  need = 0;
+  for (v = start; v < start + npages; v++) {
+    if (vr_lookup(currpid, v) == NULL) {
+      restore(ps);
+      return SYSERR;
+    }
+    if ((pte = xm_lookup_pte(currpid, v)) == NULL || !(pte->pt_avail & PT_LOCK)) {
+      need++;
+    }
+  }
+  if (proctab[currpid].plocked + need > XM_LOCKLIM) {
+    restore(ps);
+    return SYSERR;
+  }
+
+  for (v = start; v < start + npages; v++) {
+    // Making room for the private copy may evict the page itself
+    vr = vr_lookup(currpid, v);
+    do {
+      if ((pte = pf_fetch(vr, v)) == NULL ||
+          ((pte->pt_avail & PT_COW) && cow_fault(pte, v) == SYSERR)) {
+        restore(ps);
+        return SYSERR;
+      }
+    } while (!pte->pt_pres);
+    if (pte->pt_avail & PT_LOCK) {
+      continue;
+    }
+    pte->pt_avail |= PT_LOCK;
+    f = (int)pte->pt_base - FRAME0;
+    if (frm_tab[f].fr_pin++ == 0) {
+      pr_curr->pp_remove(f);
+    }
+    proctab[currpid].plocked++;
+  }
+  restore(ps);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * xm_unlock_range - drop pid's locks on pages vpno to vpno+n-1
+ *-------------------------------------------------------------------------
+ */
+void xm_unlock_range(int pid, int vpno, int n)
+{
+  pt_t *pte;
+  int v, f;
+
+  for (v = vpno; v < vpno + n && proctab[pid].plocked > 0; v++) {
+    if ((pte = xm_lookup_pte(pid, v)) == NULL || !(pte->pt_avail & PT_LOCK)) {
+      continue;
+    }
+    pte->pt_avail &= ~PT_LOCK;
+    f = (int)pte->pt_base - FRAME0;
+    if (--frm_tab[f].fr_pin == 0) {
+      pr_curr->pp_insert(f);
+    }
+    proctab[pid].plocked--;
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * xm_unlock_all - drop every lock pid holds, as it exits
+ *-------------------------------------------------------------------------
+ */
+void xm_unlock_all(int pid)
+{
+  vindex_t *vi = &vr_tab[pid];
+  int i;
+
+  for (i = 0; i < vi->vi_count && proctab[pid].plocked > 0; i++) {
+    xm_unlock_range(pid, vi->vi_reg[i].vr_vpno, vi->vi_reg[i].vr_npages);
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * xmunlock - let the npages pages at vaddr be paged out again
+ *-------------------------------------------------------------------------
+ */
+SYSCALL xmunlock(unsigned long vaddr, int npages)
+{
+  STATWORD ps;
+
+  if ((vaddr & (NBPG - 1)) != 0 || npages <= 0) {
+    return SYSERR;
+  }
+  disable(ps);
+  xm_unlock_range(currpid, (int)(vaddr >> 12), npages);
+  restore(ps);
+  return OK;
+}
@@ -0,0 +1,383 @@
+/* zswap.c - zswap, compressed in-memory tier in front of the store pool */
+
+#include <conf.h>
+#include <kernel.h>
+#include <proc.h>
+#include <paging.h>
+
+/* A page written to a backing store is first offered to this tier.  A
+ * page of zeroes is just marked unwritten, so it reads back zero-filled;
+ * a page repeating any other 32-bit word keeps only that word.  Other
+ * pages are LZ77-compressed and, if that saves at least half the page,
+ * kept in zs_pool in ZS_UNIT pieces.  Pages held here take no chunk from
+ * the store pool and are never copied to it; bs_zmap says which pages of
+ * a store they are, and read_bs() expands them straight into the frame.
+ */
+#define ZS_POOLSIZE	(64 * NBPG)	/* bytes of compressed pages	*/
+#define ZS_UNIT		64		/* allocation unit in zs_pool	*/
+#define ZS_NUNITS	(ZS_POOLSIZE / ZS_UNIT)
+#define ZS_MAXLEN	(NBPG / 2)	/* keep only if it halves the page */
+#define ZS_NENT		1024		/* pages the tier can hold	*/
+#define ZS_NHASH	256
+#define zs_hash(bs, pg)	((((bs) * 31) + (pg)) & (ZS_NHASH - 1))
+
+#define LZ_NHASH	1024		/* compressor match table	*/
+#define LZ_MAXOFF	4095		/* 12-bit match offset		*/
+#define LZ_MAXLEN	18		/* 4-bit match length, plus 3	*/
+
+typedef struct {
+  short ze_bs;				/* store and page held, or	*/
+  short ze_page;			/* ze_bs == -1 if free		*/
+  short ze_len;				/* compressed bytes, 0 if filled */
+  short ze_next;			/* hash chain or free list	*/
+  unsigned long ze_val;			/* fill word, or first pool unit */
+} zsent_t;
+
+static unsigned char zs_pool[ZS_POOLSIZE];
+static unsigned long zs_umap[ZS_NUNITS / 32];	/* bit set: unit is free */
+static zsent_t zs_ent[ZS_NENT];
+static short zs_head[ZS_NHASH];
+static short zs_free;
+
+static unsigned short lz_tab[LZ_NHASH];	/* 1 + last position of a hash	*/
+static unsigned char zs_buf[ZS_MAXLEN];
+
+extern void bcopy(void *src, void *dst, int n);	/* in startup.S */
+
+int zs_on = 1;				/* tier in use for new writes	*/
+int zs_nunits = 0;			/* pool units in use		*/
+unsigned long zs_nzero = 0, zs_nsame = 0, zs_ncomp = 0, zs_nreject = 0;
+
+/*-------------------------------------------------------------------------
+ * zs_init - empty the tier
+ *-------------------------------------------------------------------------
+ */
+void zs_init(void)
+{
+  int i;
+
+  for (i = 0; i < ZS_NUNITS / 32; i++) {
+    zs_umap[i] = ~0UL;
+  }
+  for (i = 0; i < ZS_NHASH; i++) {
+    zs_head[i] = -1;
+  }
+  for (i = 0; i < ZS_NENT; i++) {
+    zs_ent[i].ze_bs = -1;
+    zs_ent[i].ze_next = i + 1 < ZS_NENT ? i + 1 : -1;
+  }
+  zs_free = 0;
+  zs_nunits = 0;
+}
+
+/*-------------------------------------------------------------------------
+ * zswap - turn the compressed tier on or off for pages written from now
+ * on; pages it already holds stay readable either way
+ *-------------------------------------------------------------------------
+ */
+SYSCALL zswap(int on)
+{
+  zs_on = on ? 1 : 0;
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * lz_compress - compress the page at src into dst; return the length,
+ * or -1 if it does not fit in max bytes
+ *
+ * Each group of up to 16 items is preceded by a 16-bit control word; a
+ * set bit is a 2-byte match (12-bit offset, 4-bit length - 3) and a
+ * clear one a literal byte.  Matches are found through a table of the
+ * last position of each 3-byte prefix hash.
+ *-------------------------------------------------------------------------
+ */
+static int lz_compress(unsigned char *src, unsigned char *dst, int max)
+{
+  int ip = 0, op = 0, cp, bit, h, ref, off, len;
+  unsigned ctl;
+
+  for (h = 0; h < LZ_NHASH; h++) {
+    lz_tab[h] = 0;
+  }
+  while (ip < NBPG) {
+    // Room for a full group, so the items need no checks of their own
+    if (op + 2 + 16 * 2 > max) {
+      return -1;
+    }
+    cp = op;
+    op += 2;
+    ctl = 0;
+    for (bit = 0; bit < 16 && ip < NBPG; bit++) {
+      if (ip + 3 <= NBPG) {
+        h = (((src[ip] << 16) | (src[ip + 1] << 8) | src[ip + 2]) *
+             2654435761U) >> 22;
+        ref = lz_tab[h] - 1;
+        lz_tab[h] = ip + 1;
+        off = ip - ref;
+        if (ref >= 0 && off <= LZ_MAXOFF && src[ref] == src[ip] &&
+            src[ref + 1] == src[ip + 1] && src[ref + 2] == src[ip + 2]) {
+          for (len = 3; len < LZ_MAXLEN && ip + len < NBPG &&
+               src[ref + len] == src[ip + len]; len++)
+            ;
+          dst[op++] = ((off >> 4) & 0xF0) | (len - 3);
+          dst[op++] = off & 0xFF;
+          ctl |= 1 << bit;
+          ip += len;
+          continue;
+        }
+      }
+      dst[op++] = src[ip++];
+    }
+    dst[cp] = ctl & 0xFF;
+    dst[cp + 1] = ctl >> 8;
+  }
+  return op;
+}
+
+/*-------------------------------------------------------------------------
+ * lz_expand - undo lz_compress(), filling the page at dst
+ *-------------------------------------------------------------------------
+ */
+static void lz_expand(unsigned char *src, unsigned char *dst)
+{
+  int ip = 0, op = 0, bit, off, len;
+  unsigned ctl;
+
+  while (op < NBPG) {
+    ctl = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    for (bit = 0; bit < 16 && op < NBPG; bit++) {
+      if (ctl & (1 << bit)) {
+        off = ((src[ip] & 0xF0) << 4) | src[ip + 1];
+        len = (src[ip] & 0x0F) + 3;
+        ip += 2;
+        // Byte by byte: a match may overlap what it produces
+        for (; len > 0; len--, op++) {
+          dst[op] = dst[op - off];
+        }
+      } else {
+        dst[op++] = src[ip++];
+      }
+    }
+  }
+}
+
+/*-------------------------------------------------------------------------
+ * zs_ualloc - take n contiguous pool units; return the first or -1
+ *-------------------------------------------------------------------------
+ */
+static int zs_ualloc(int n)
+{
+  int u, run = 0;
+
+  for (u = 0; u < ZS_NUNITS; u++) {
+    if (run == 0 && (u & 31) == 0 && zs_umap[u >> 5] == 0) {
+      u += 31;
+      continue;
+    }
+    if (!(zs_umap[u >> 5] & (1UL << (u & 31)))) {
+      run = 0;
+      continue;
+    }
+    if (++run == n) {
+      for (u -= n - 1, run = 0; run < n; run++) {
+        zs_umap[(u + run) >> 5] &= ~(1UL << ((u + run) & 31));
+      }
+      zs_nunits += n;
+      return u;
+    }
+  }
+  return -1;
+}
+
+/*-------------------------------------------------------------------------
+ * zs_ufree - give back the n pool units starting at u
+ *-------------------------------------------------------------------------
+ */
+static void zs_ufree(int u, int n)
+{
+  zs_nunits -= n;
+  for (n += u; u < n; u++) {
+    zs_umap[u >> 5] |= 1UL << (u & 31);
+  }
+}
+
+#define zs_units(len)	(((len) + ZS_UNIT - 1) / ZS_UNIT)
+
+/*-------------------------------------------------------------------------
+ * zs_find - return the entry holding page pageth of store bs, or -1
+ *-------------------------------------------------------------------------
+ */
+static int zs_find(int bs, int pageth)
+{
+  int e;
+  for (e = zs_head[zs_hash(bs, pageth)]; e != -1; e = zs_ent[e].ze_next) {
+    if (zs_ent[e].ze_bs == bs && zs_ent[e].ze_page == pageth) {
+      return e;
+    }
+  }
+  return -1;
+}
+
+/*-------------------------------------------------------------------------
+ * zs_enter - take an entry for page pageth of store bs, or -1 if none
+ * is free; the caller fills in ze_len and ze_val
+ *-------------------------------------------------------------------------
+ */
+static int zs_enter(int bs, int pageth)
+{
+  int e = zs_free, h = zs_hash(bs, pageth);
+
+  if (e == -1) {
+    return -1;
+  }
+  zs_free = zs_ent[e].ze_next;
+  zs_ent[e].ze_bs = bs;
+  zs_ent[e].ze_page = pageth;
+  zs_ent[e].ze_next = zs_head[h];
+  zs_head[h] = e;
+  bs_mark_written(bs, pageth);
+  bs_mark_zipped(bs, pageth);
+  return e;
+}
+
+/*-------------------------------------------------------------------------
+ * zs_forget - drop whatever the tier holds for page pageth of store bs;
+ * the page's bs_wmap bit is left to the caller
+ *-------------------------------------------------------------------------
+ */
+void zs_forget(int bs, int pageth)
+{
+  STATWORD ps;
+  short *link;
+  int e;
+
+  if (!bs_zipped(bs, pageth)) {
+    return;
+  }
+  disable(ps);
+  for (link = &zs_head[zs_hash(bs, pageth)]; (e = *link) != -1;
+       link = &zs_ent[e].ze_next) {
+    if (zs_ent[e].ze_bs == bs && zs_ent[e].ze_page == pageth) {
+      *link = zs_ent[e].ze_next;
+      if (zs_ent[e].ze_len > 0) {
+        zs_ufree(zs_ent[e].ze_val, zs_units(zs_ent[e].ze_len));
+      }
+      zs_ent[e].ze_bs = -1;
+      zs_ent[e].ze_next = zs_free;
+      zs_free = e;
+      break;
+    }
+  }
+  bsm_tab[bs].bs_zmap[pageth >> 5] &= ~(1UL << (pageth & 31));
+  restore(ps);
+}
+
+/*-------------------------------------------------------------------------
+ * zs_store - keep the page at src as page pageth of store bs if it is
+ * zero, same-filled or compresses well; SYSERR means it must go to the
+ * store pool instead.  Any older copy in the tier must be gone already.
+ *-------------------------------------------------------------------------
+ */
+SYSCALL zs_store(char *src, int bs, int pageth)
+{
+  STATWORD ps;
+  unsigned long *w = (unsigned long *)src;
+  int i, e, u, len;
+
+  if (!zs_on) {
+    return SYSERR;
+  }
+
+  for (i = 1; i < NBPG / 4 && w[i] == w[0]; i++)
+    ;
+  if (i == NBPG / 4 && w[0] == 0) {
+    bsm_tab[bs].bs_wmap[pageth >> 5] &= ~(1UL << (pageth & 31));
+    zs_nzero++;
+    return OK;
+  }
+
+  disable(ps);
+  if (i == NBPG / 4) {
+    if ((e = zs_enter(bs, pageth)) == -1) {
+      restore(ps);
+      return SYSERR;
+    }
+    zs_ent[e].ze_len = 0;
+    zs_ent[e].ze_val = w[0];
+    zs_nsame++;
+    restore(ps);
+    return OK;
+  }
+
+  if ((len = lz_compress((unsigned char *)src, zs_buf, ZS_MAXLEN)) < 0) {
+    zs_nreject++;
+    restore(ps);
+    return SYSERR;
+  }
+  if (zs_free == -1 || (u = zs_ualloc(zs_units(len))) == -1) {
+    restore(ps);
+    return SYSERR;
+  }
+  e = zs_enter(bs, pageth);
+  zs_ent[e].ze_len = len;
+  zs_ent[e].ze_val = u;
+  bcopy((void *)zs_buf, (void *)&zs_pool[u * ZS_UNIT], len);
+  zs_ncomp++;
+  restore(ps);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * zs_load - fill the page at dst from page pageth of store bs, which
+ * must be held by the tier
+ *-------------------------------------------------------------------------
+ */
+SYSCALL zs_load(char *dst, int bs, int pageth)
+{
+  STATWORD ps;
+  int e;
+
+  disable(ps);
+  if ((e = zs_find(bs, pageth)) == -1) {
+    restore(ps);
+    return SYSERR;
+  }
+  if (zs_ent[e].ze_len == 0) {
+    pg_fill(dst, zs_ent[e].ze_val);
+  } else {
+    lz_expand(&zs_pool[zs_ent[e].ze_val * ZS_UNIT], (unsigned char *)dst);
+  }
+  restore(ps);
+  return OK;
+}
+
+/*-------------------------------------------------------------------------
+ * zs_copy - make page pageth of store dst a copy of the same page of
+ * store src, held by the tier, without expanding it
+ *-------------------------------------------------------------------------
+ */
+SYSCALL zs_copy(int dst, int src, int pageth)
+{
+  STATWORD ps;
+  int e, d, u = 0;
+
+  disable(ps);
+  if ((e = zs_find(src, pageth)) == -1 || zs_free == -1 ||
+      (zs_ent[e].ze_len > 0 &&
+       (u = zs_ualloc(zs_units(zs_ent[e].ze_len))) == -1)) {
+    restore(ps);
+    return SYSERR;
+  }
+  d = zs_enter(dst, pageth);
+  zs_ent[d].ze_len = zs_ent[e].ze_len;
+  if (zs_ent[e].ze_len > 0) {
+    zs_ent[d].ze_val = u;
+    bcopy((void *)&zs_pool[zs_ent[e].ze_val * ZS_UNIT],
+          (void *)&zs_pool[u * ZS_UNIT], zs_ent[e].ze_len);
+  } else {
+    zs_ent[d].ze_val = zs_ent[e].ze_val;
+  }
+  restore(ps);
+  return OK;
+}
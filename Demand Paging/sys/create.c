@@ -9,8 +9,6 @@
 #include <io.h>
 #include <paging.h>
 
-extern unsigned long global_pt_addrs[4];
-
 LOCAL int newpid();
 
 /*------------------------------------------------------------------------
@@ -33,15 +31,20 @@ SYSCALL create(procaddr,ssize,priority,name,nargs,args)
 	int		i;
 	unsigned long	*a;		/* points to list of args	*/
 	unsigned long	*saddr;		/* stack address		*/
+	int		paged;		/* stack in the paged area	*/
 	int		INITRET();
 
 	disable(ps);
+	paged = stk_paged;
+	stk_paged = 0;
 	if (ssize < MINSTK)
 		ssize = MINSTK;
+	if (paged && ssize > STK_MAX)	/* the rest of the slot is guard */
+		ssize = STK_MAX;
 	ssize = (int) roundew(ssize);
-	if (((saddr = (unsigned long *)getstk(ssize)) ==
-	    (unsigned long *)SYSERR ) ||
-	    (pid=newpid()) == SYSERR || priority < 1 ) {
+	if (priority < 1 || (pid=newpid()) == SYSERR ||
+	    (saddr = paged ? stk_alloc(pid) : (unsigned long *)getstk(ssize)) ==
+	    (unsigned long *)SYSERR) {
 		restore(ps);
 		return(SYSERR);
 	}
@@ -73,8 +76,6 @@ SYSCALL create(procaddr,ssize,priority,name,nargs,args)
 	// Map first 16 MB (pages 0-4095) to physical memory using global page tables
 	int pd_frame_idx;
 	unsigned long phys_addr;
-	unsigned long pt_phys_addr;
-	unsigned long pt_frame_num;
 	pd_t *pd;
 	
 	if (get_frm(&pd_frame_idx) == SYSERR) {
@@ -87,37 +88,10 @@ SYSCALL create(procaddr,ssize,priority,name,nargs,args)
 	pd = (pd_t *)phys_addr;
 	
 	// Initialize all page directory entries to zero
-	for (i = 0; i < 1024; i++) {
-		pd[i].pd_pres = 0;
-		pd[i].pd_write = 0;
-		pd[i].pd_user = 0;
-		pd[i].pd_pwt = 0;
-		pd[i].pd_pcd = 0;
-		pd[i].pd_acc = 0;
-		pd[i].pd_mbz = 0;
-		pd[i].pd_fmb = 0;
-		pd[i].pd_global = 0;
-		pd[i].pd_avail = 0;
-		pd[i].pd_base = 0;
-	}
+	pg_zero(pd);
 	
-	// Map first 16 MB (pages 0-4095) to physical memory using global page tables
-	// Pages 0-4095 correspond to page directory indices 0-3 (each covers 1024 pages)
-	for (i = 0; i < 4; i++) {
-		pt_phys_addr = global_pt_addrs[i];
-		pt_frame_num = pt_phys_addr >> 12;
-		pd[i].pd_base = (unsigned int)(pt_frame_num);
-		pd[i].pd_pres = 1;
-		pd[i].pd_write = 1;
-		pd[i].pd_user = 0;
-		pd[i].pd_pwt = 0;
-		pd[i].pd_pcd = 0;
-		pd[i].pd_acc = 0;
-		pd[i].pd_mbz = 0;
-		pd[i].pd_fmb = 0;
-		pd[i].pd_global = 0;
-		pd[i].pd_avail = 0;
-	}
+	// Map first 16 MB (pages 0-4095) to physical memory
+	init_global_pde(pd);
 	
 	// Update frame table for page directory
 	frm_tab[pd_frame_idx].fr_status = FRM_MAPPED;
@@ -128,6 +102,12 @@ SYSCALL create(procaddr,ssize,priority,name,nargs,args)
 	frm_tab[pd_frame_idx].fr_dirty = 0;
 	
 	pptr->is_virtual = 0;
+	pptr->prss = pptr->pwss = pptr->prss_hand = 0;
+	pptr->prss_soft = pptr->prss_hard = 0;
+	pptr->pmajflt = pptr->pminflt = pptr->pnevict = 0;
+	pptr->ppgin = pptr->ppgout = 0;
+	pptr->ppwant = pptr->pptold = PP_NONE;
+	pptr->plocked = 0;
 
 		/* Bottom of stack */
 	*saddr = MAGIC;
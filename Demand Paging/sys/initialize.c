@@ -57,6 +57,7 @@ int page_replace_policy = SC;
 
 // Global page tables - store physical addresses of the 4 page tables 
 unsigned long global_pt_addrs[4];  // Physical addresses of 4 global page tables 
+int pg_pse = 0;                    // First 16MB mapped with 4MB pages instead
 
 /************************************************************************/
 /***				NOTE:				      ***/
@@ -121,6 +122,9 @@ nulluser()				/* babysit CPU when no one is home */
 	kprintf("clock %sabled\n", clkruns == 1?"en":"dis");
 
 
+	/* start the dirty-page writeback daemon */
+	init_wbd();
+
 	/* create a process to execute the user's main program */
 	userpid = create(main,INITSTK,INITPRIO,INITNAME,INITARGS);
 	resume(userpid);
@@ -138,6 +142,19 @@ int init_global_page_tables()
 	unsigned long frame_num;
 	int frame_idx;  /* Frame index in frm_tab */
 	
+	// With PSE the identity map is four 4MB directory entries, so the
+	// frames that would have held the global page tables go back to the pool
+	if (cpu_features() & CPUID_PSE) {
+		write_cr4(read_cr4() | CR4_PSE);
+		pg_pse = 1;
+		for (i = 0; i < 4; i++) {
+			global_pt_addrs[i] = 0;
+			frm_tab[i].fr_status = FRM_MAPPED;
+			free_frm(i);
+		}
+		kprintf("Global mappings use 4MB pages, frames 0-3 freed\n");
+		return OK;
+	}
 	
 	for (i = 0; i < 4; i++) {
 		frame_idx = i;  // Global page tables will be in frames 0-3 
@@ -157,7 +174,7 @@ int init_global_page_tables()
 			pt[j].pt_acc = 0;
 			pt[j].pt_dirty = 0;
 			pt[j].pt_mbz = 0;
-			pt[j].pt_global = 0;
+			pt[j].pt_global = 1;  // Same in every address space
 			pt[j].pt_avail = 0;
 			pt[j].pt_base = (unsigned int)(frame_num);  // Set physical frame number
 		}
@@ -178,52 +195,66 @@ int init_global_page_tables()
 	return OK;
 }
 
+/*------------------------------------------------------------------------
+ *  init_global_pde  --  map the first 16MB (pages 0-4095) into the
+ *  first four entries of page directory pd, and the paged stacks
+ *------------------------------------------------------------------------
+ */
+void init_global_pde(pd_t *pd)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		pd[i].pd_pres = 1;
+		pd[i].pd_write = 1;
+		pd[i].pd_user = 0;
+		pd[i].pd_pwt = 0;
+		pd[i].pd_pcd = 0;
+		pd[i].pd_acc = 0;
+		pd[i].pd_mbz = 0;
+		pd[i].pd_global = pg_pse;	// G bit only counts on 4MB entries
+		pd[i].pd_avail = 0;
+		if (pg_pse) {
+			// 4MB page: pd_base bits 10-19 hold the frame's top bits
+			pd[i].pd_fmb = 1;
+			pd[i].pd_base = (unsigned int)(i << 10);
+		} else {
+			pd[i].pd_fmb = 0;
+			pd[i].pd_base = (unsigned int)(global_pt_addrs[i] >> 12);
+		}
+	}
+	stk_map(pd);
+}
+
 // Allocate and initialize page directory for NULL process
 int init_null_pd()
 {
 	int i;
 	pd_t *pd;                    
 	unsigned long phys_addr;
-	unsigned long pt_phys_addr;
-	unsigned long pt_frame_num;
 	int frame_idx = 4; // reserve frame 4 for NULL process page directory
 	
 	phys_addr = (FRAME0 + frame_idx) * NBPG;
 	pd = (pd_t *)phys_addr;
 	
-	// Zero out and set up all 1024 entries in the page directory
-	for (i = 0; i < 1024; i++) {
-		if (i < 4) {
-			// First 4 entries point to global page tables (identity mapping for pages 0-4095)
-			pt_phys_addr = global_pt_addrs[i];
-			pt_frame_num = pt_phys_addr >> 12;
-			pd[i].pd_pres = 1;              // Page table is present 
-			pd[i].pd_write = 1;
-			pd[i].pd_user = 0;
-			pd[i].pd_pwt = 0;
-			pd[i].pd_pcd = 0;
-			pd[i].pd_acc = 0;
-			pd[i].pd_mbz = 0;
-			pd[i].pd_fmb = 0;
-			pd[i].pd_global = 0;
-			pd[i].pd_avail = 0;
-			pd[i].pd_base = (unsigned int)(pt_frame_num);
-		} else {
-			// All other entries are not present
-			pd[i].pd_pres = 0;
-			pd[i].pd_write = 0;
-			pd[i].pd_user = 0;
-			pd[i].pd_pwt = 0;
-			pd[i].pd_pcd = 0;
-			pd[i].pd_acc = 0;
-			pd[i].pd_mbz = 0;
-			pd[i].pd_fmb = 0;
-			pd[i].pd_global = 0;
-			pd[i].pd_avail = 0;
-			pd[i].pd_base = 0;
-		}
+	// All entries past the identity mapping start out not present
+	for (i = 4; i < 1024; i++) {
+		pd[i].pd_pres = 0;
+		pd[i].pd_write = 0;
+		pd[i].pd_user = 0;
+		pd[i].pd_pwt = 0;
+		pd[i].pd_pcd = 0;
+		pd[i].pd_acc = 0;
+		pd[i].pd_mbz = 0;
+		pd[i].pd_fmb = 0;
+		pd[i].pd_global = 0;
+		pd[i].pd_avail = 0;
+		pd[i].pd_base = 0;
 	}
 	
+	// First 4 entries map pages 0-4095 one to one
+	init_global_pde(pd);
+	
 	/* Store the page directory address in NULL process entry */
 	proctab[NULLPROC].pdbr = phys_addr;
 
@@ -297,6 +328,9 @@ sysinit()
 
 	mon_init();     /* init monitor */
 
+	/* Pick the page zero and copy kernels for this CPU */
+	pg_init();
+
 	/* Initialize inverted page table */
 	init_frm();
 
@@ -312,12 +346,18 @@ sysinit()
 	// Install page fault interrupt service routine (interrupt 14) */
 	set_evec(14, (u_long)pfintr);
 
+	// The double fault task that grows paged stacks
+	stk_init();
+
 	// Enable paging - this must be done AFTER setting up page tables and CR3 */
 	enable_paging();
 
 	/* Initialize backing store mapping table */
 	init_bsm();
 
+	/* Initialize per-process virtual region index */
+	init_vregion();
+
 #ifdef NDEVS
 	for (i=0 ; i<NDEVS ; i++ ) {	    
 	    init_dev(i);
@@ -10,6 +10,115 @@
 #include <stdio.h>
 #include <paging.h>
 
+/*------------------------------------------------------------------------
+ * kill_flush  --  write the dirty xmmap pages queued in vec to store,
+ *		   then free their frames
+ *------------------------------------------------------------------------
+ */
+LOCAL void kill_flush(int store, bsvec_t *vec, int n)
+{
+	int	k;
+
+	if (n > 0 && write_bs_v((bsd_t)store, vec, n) == SYSERR)
+		kprintf("kill: writeback to store %d failed\n", store);
+	for (k = 0; k < n; k++)
+		free_frm(vec[k].bv_frm);
+}
+
+/*------------------------------------------------------------------------
+ * kill_frames  --  release the pages and page tables of process pid,
+ *		    whose page directory is pd, in one pass over frm_tab
+ *
+ * Heap pages are freed unwritten, since the heap's store goes with the
+ * process.  Only xmmap pages reach their store: the dirty ones this
+ * process was the last to map, batched here, and the others through
+ * pc_drop() once their last mapper lets go.  A frame other processes
+ * still share just loses this process's reference.
+ *------------------------------------------------------------------------
+ */
+LOCAL void kill_frames(int pid, pd_t *pd)
+{
+	bsvec_t		vec[BS_NVEC];	/* dirty xmmap pages to write	*/
+	int		nvec = 0;
+	int		store = -1;
+	vindex_t	*vi = &vr_tab[pid];
+	vregion_t	*vr;
+	pt_t		*pte;
+	int		f, i, pd_idx;
+
+	// A table shared since vfork() stays with the others
+	for (pd_idx = 4; pd_idx < 1024; pd_idx++) {
+		if (pd[pd_idx].pd_pres &&
+		    (pd_idx < STK_PDE || pd_idx >= STK_PDE + STK_NPT) &&
+		    frm_tab[(int)pd[pd_idx].pd_base - FRAME0].fr_nshare > 1)
+			pt_drop_share(pid, pd, pd_idx);
+	}
+
+	for (f = 0; f < NFRAMES; f++) {
+		if (frm_tab[f].fr_status != FRM_MAPPED ||
+		    frm_tab[f].fr_type != FR_PAGE)
+			continue;
+
+		// A copy-on-write frame is at the same page in every sharer;
+		// a page cache frame at its store page in each mapping, and
+		// this process may map the store more than once
+		if (frm_tab[f].fr_refcnt > 1) {
+			if (frm_tab[f].fr_bs == -1) {
+				if ((pte = cow_pte(pid, frm_tab[f].fr_vpno, f)) != NULL) {
+					pte->pt_pres = 0;
+					cow_drop(f, pid);
+				}
+				continue;
+			}
+			for (i = 0; i < vi->vi_count; i++) {
+				vr = &vi->vi_reg[i];
+				if (vr->vr_type == BS_TYPE_XMMAP &&
+				    vr->vr_bs_id == frm_tab[f].fr_bs &&
+				    (pte = cow_pte(pid, vr->vr_vpno +
+				    frm_tab[f].fr_bspage, f)) != NULL) {
+					pte->pt_pres = 0;
+					pc_drop(f, pid, pte->pt_dirty);
+				}
+			}
+			continue;
+		}
+		if (frm_tab[f].fr_pid != pid)
+			continue;
+
+		// A batch goes out when it is full or the next page is in
+		// another store
+		if (frm_tab[f].fr_bs != -1 && (frm_tab[f].fr_dirty ||
+		    ((pte = cow_pte(pid, frm_tab[f].fr_vpno, f)) != NULL &&
+		    pte->pt_dirty))) {
+			if (nvec > 0 && (frm_tab[f].fr_bs != store ||
+			    nvec == BS_NVEC)) {
+				kill_flush(store, vec, nvec);
+				nvec = 0;
+			}
+			store = frm_tab[f].fr_bs;
+			vec[nvec].bv_page = frm_tab[f].fr_bspage;
+			vec[nvec].bv_frm = f;
+			nvec++;
+			continue;
+		}
+		free_frm(f);
+	}
+	kill_flush(store, vec, nvec);
+
+	// What is left in the directory is private, including tables
+	// unhooked for pt_reclaim()
+	for (pd_idx = 4; pd_idx < 1024; pd_idx++) {
+		f = (int)pd[pd_idx].pd_base - FRAME0;
+		if ((pd_idx >= STK_PDE && pd_idx < STK_PDE + STK_NPT) ||
+		    f < 0 || f >= NFRAMES)
+			continue;
+		if (frm_tab[f].fr_type == FR_TBL && frm_tab[f].fr_pid == pid)
+			free_frm(f);
+		pd[pd_idx].pd_pres = 0;
+		pd[pd_idx].pd_base = 0;
+	}
+}
+
 /*------------------------------------------------------------------------
  * kill  --  kill a process and remove it from the system
  *------------------------------------------------------------------------
@@ -19,16 +128,7 @@ SYSCALL kill(int pid)
 	STATWORD ps;    
 	struct	pentry	*pptr;		/* points to proc. table for pid*/
 	int	dev;
-	int	i;
-	int	vpno;
-	unsigned long	vaddr;
-	unsigned long	page_phys_addr;
-	unsigned long	pt_phys_addr;
 	pd_t		*pd;
-	pt_t		*pt;
-	unsigned int	pd_idx, pt_idx;
-	int		store, pageth;
-	int		page_frm_idx;
 
 	disable(ps);
 	if (isbadpid(pid) || (pptr= &proctab[pid])->pstate==PRFREE) {
@@ -48,136 +148,60 @@ SYSCALL kill(int pid)
 	if (! isbaddev(dev) )
 		close(dev);
 	
-	// Clean up virtual memory if this is a virtual process
-	if (pptr->is_virtual) {
-		pd = (pd_t *)pptr->pdbr;
-		
-		// Step 1: Iterate through page tables to find and write dirty pages
-		// This is faster than iterating through all frames since we only check mapped pages
-		for (pd_idx = 4; pd_idx < 1024; pd_idx++) {
-			if (!pd[pd_idx].pd_pres) {
-				continue; // Skip if page table doesn't exist
-			}
-			
-			pt_phys_addr = pd[pd_idx].pd_base << 12;
-			pt = (pt_t *)pt_phys_addr;
-			
-			// Iterate through all entries in this page table
-			for (pt_idx = 0; pt_idx < 1024; pt_idx++) {
-				if (!pt[pt_idx].pt_pres) {
-					continue; // Skip if page is not present
-				}
-				
-				// Calculate virtual page number and address
-				vpno = (pd_idx << 10) | pt_idx;
-				vaddr = (unsigned long)vpno << 12;
-				
-				// Get frame index from page table entry
-				page_frm_idx = (int)pt[pt_idx].pt_base - FRAME0;
-				
-				// Verify this frame actually belongs to this process
-				if (page_frm_idx < 0 || page_frm_idx >= NFRAMES ||
-				    frm_tab[page_frm_idx].fr_pid != pid ||
-				    frm_tab[page_frm_idx].fr_type != FR_PAGE) {
-					continue; // Skip if frame doesn't belong to this process
-				}
-				
-				// Write dirty page to backing store
-				if (pt[pt_idx].pt_dirty) {
-					// Find backing store for this page
-					if (bsm_lookup(pid, vaddr, &store, &pageth) == OK) {
-						page_phys_addr = (FRAME0 + page_frm_idx) * NBPG;
-						write_bs((char *)page_phys_addr, (bsd_t)store, pageth);
-					}
-					if (xmmap_lookup(pid, vaddr, &store, &pageth) == OK) {
-						page_phys_addr = (FRAME0 + page_frm_idx) * NBPG;
-						write_bs((char *)page_phys_addr, (bsd_t)store, pageth);
-					}
-				}
-				
-				// Mark page table entry as not present
-				pt[pt_idx].pt_pres = 0;
-				pt[pt_idx].pt_dirty = 0;
-				
-				// Free the page frame
-				free_frm(page_frm_idx);
-				
-				// Decrement reference count of page table frame
-				{
-					int pt_frm_idx = (int)pd[pd_idx].pd_base - FRAME0;
-					if (pt_frm_idx >= 0 && pt_frm_idx < NFRAMES) {
-						frm_tab[pt_frm_idx].fr_refcnt--;
-					}
-				}
-			}
-		}
+	pd = (pd_t *)pptr->pdbr;
+	
+	// Resident pages above the identity map belong to the heap or to
+	// xmmap regions, which create()d processes may hold too
+	if (pd != NULL) {
 		
+		// Locked pages go back to the policy first
+		if (pptr->plocked > 0)
+			xm_unlock_all(pid);
 		
+		kill_frames(pid, pd);
+	}
+	
+	if (pptr->is_virtual) {
 		// Remove bsm_tab entries for virtual heap
 		if (pptr->vhpno > 0) {
 			bsm_unmap(pid, pptr->vhpno);
 		}
 		
-		// Clean up xmmap entries for this process
-		{
-			int i;
-			for (i = 0; i < xmmap_count; i++) {
-				if (xmmap_tab[i].xm_pid == pid) {
-					// Clear the xmmap entry
-					xmmap_tab[i].xm_pid = -1;
-					xmmap_tab[i].xm_vpno = 0;
-					xmmap_tab[i].xm_npages = 0;
-					xmmap_tab[i].xm_bs_id = -1;
-				}
-			}
-		}
-		
 		// Free backing store reservation
 		if (pptr->store >= 0 && pptr->store < MAX_BS) {
 			free_bsm(pptr->store);
 		}
 		
-		// Free page directory frame
-		for (i = 0; i < NFRAMES; i++) {
-			if (frm_tab[i].fr_status == FRM_MAPPED && 
-			    frm_tab[i].fr_pid == pid &&
-			    frm_tab[i].fr_type == FR_DIR) {
-				free_frm(i);
-				break;
-			}
-		}
-		
 		// Clear process memory management fields
-		pptr->pdbr = 0;
 		pptr->store = -1;
 		pptr->vhpno = 0;
 		pptr->vhpnpages = 0;
 	}
 
-	// Step 2: Free all page table frames owned by this process
-	for (i = 0; i < NFRAMES; i++) {
-		if (frm_tab[i].fr_status == FRM_MAPPED && 
-			frm_tab[i].fr_pid == pid &&
-			frm_tab[i].fr_type == FR_TBL) {
-			
-			// Find which page directory entry points to this table
-			for (pd_idx = 0; pd_idx < 1024; pd_idx++) {
-				if (pd[pd_idx].pd_pres && 
-					(int)pd[pd_idx].pd_base == (FRAME0 + i)) {
-					pd[pd_idx].pd_pres = 0;
-					pd[pd_idx].pd_base = 0;
-					break;
-				}
-			}
-			
-			// Free the page table frame
-			free_frm(i);
+	// Drop whatever is left in the region index; create()d processes may
+	// hold xmmap regions too
+	while (vr_tab[pid].vi_count > 0) {
+		vregion_t *vr = &vr_tab[pid].vi_reg[0];
+		// A region xm_release() cannot find is dropped here instead,
+		// or the loop would never end
+		if (vr->vr_type != BS_TYPE_XMMAP ||
+		    xm_release(vr->vr_xm_idx) == SYSERR) {
+			vr_remove(pid, vr->vr_vpno);
 		}
 	}
+
+	// The page directory goes last; every process has one
+	if (pd != NULL) {
+		free_frm((int)(pptr->pdbr / NBPG) - FRAME0);
+		pptr->pdbr = 0;
+	}
 	
 	send(pptr->pnxtkin, pid);
 
-	freestk(pptr->pbase, pptr->pstklen);
+	if (stk_area(pptr->pbase >> 12))
+		stk_free(pid);
+	else
+		freestk(pptr->pbase, pptr->pstklen);
 	switch (pptr->pstate) {
 
 	case PRCURR:	pptr->pstate = PRFREE;	/* suicide */
@@ -21,6 +21,14 @@ void proc1_test6() {
 		//can go up to  (NFRAMES - 5 frames for null prc - 1pd for main - 1pd + 1pt frames for this proc)
 		//frame for pages will be from 1032-2047
 		int maxpage = (NFRAMES - (5 + 1 + 1 + 1));
+		//with 4MB global pages frames 0-3 are free: main's pd is frame 0, ours 1,
+		//our pt 2, and pages take frame 3 and then 5-1023 (frame 4 is the null pd)
+		int frm600 = 608, frm800 = 808;
+		if (pg_pse) {
+			maxpage = NFRAMES - (1 + 1 + 1 + 1);
+			frm600 = 604;
+			frm800 = 804;
+		}
 
 		for (i=0;i<=maxpage/150;i++){
             if (xmmap(PAGE0+i*150, i, 150) == SYSERR) {
@@ -44,7 +52,8 @@ void proc1_test6() {
 
 		//trigger page replacement, this should clear all access bits of all pages
 		//expected output: frame 1032 will be swapped out
-		kprintf("\n\t 6.1 Expected replaced frame: 8, page: 1032\n\t");
+		kprintf("\n\t 6.1 Expected replaced frame: %d, page: %d\n\t",
+			pg_pse ? 3 : 8, FRAME0 + (pg_pse ? 3 : 8));
 		*((int *)addrs[maxpage]) = maxpage + 1;
 
 		for(i=1; i <= maxpage; i++)
@@ -55,13 +64,15 @@ void proc1_test6() {
             }
 		}
 		//Expected page to be swapped: 1032+600 = 1632
-		kprintf("\n\t 6.2 Expected replaced frame: 608, page: 1632\n\t");
+		kprintf("\n\t 6.2 Expected replaced frame: %d, page: %d\n\t",
+			frm600, FRAME0 + frm600);
 		*((int *)addrs[maxpage+1]) = maxpage + 2;
 		temp = *((int *)addrs[maxpage+1]);
 		if (temp != maxpage +2)
 			kprintf("\tFAILED!\n");
 
-		kprintf("\n\t 6.3 Expected replaced frame: 808, page: 1832\n\t");
+		kprintf("\n\t 6.3 Expected replaced frame: %d, page: %d\n\t",
+			frm800, FRAME0 + frm800);
 		*((int *)addrs[maxpage+2]) = maxpage + 3;
 		temp = *((int *)addrs[maxpage+2]);
 		if (temp != maxpage +3)
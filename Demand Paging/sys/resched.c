@@ -7,6 +7,7 @@
 
 /* External function to write to CR3 register */
 extern void write_cr3(unsigned long);
+extern unsigned long tlb_nswitch;	/* counted in paging/invltlb.c */
 
 unsigned long currSP;	/* REAL sp of current process */
 
@@ -87,10 +88,12 @@ int	resched()
 #endif
 	
 
-	if (nptr->pdbr != 0) {
-		write_cr3(nptr->pdbr);
-	} else {
+	/* processes sharing a page directory keep the TLB warm */
+	if (nptr->pdbr == 0) {
 		panic("resched: new process has invalid pdbr");
+	} else if (nptr->pdbr != optr->pdbr) {
+		write_cr3(nptr->pdbr);
+		tlb_nswitch++;
 	}
 	
 	ctxsw(&optr->pesp, optr->pirmask, &nptr->pesp, nptr->pirmask);